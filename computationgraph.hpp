@@ -2,11 +2,18 @@
 
 #include <cassert>
 
+#include <algorithm>
 #include <concepts>
+#include <deque>
 #include <functional>
+#include <iterator>
+#include <memory>
 #include <optional>
 //#include <set>
+#include <stdexcept>
 #include <string>
+#include <typeinfo>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -55,15 +62,79 @@ namespace LazyDAW {
 		size_t slot;
 	};
 
+    // The type of payload a slot carries. The default accepts anything and is checked at run time as
+    // before; a typed slot, made with port_of<T>(), is checked once by link_node instead.
+    template<class Payload>
+    struct port_type {
+        std::type_info const * type = nullptr;
+
+        // Makes the payload hold a T (keeping the current one if it already does) and returns it.
+        void * (*bind)(Payload &) = nullptr;
+        bool (*holds)(Payload const &) = nullptr;
+
+        bool is_typed() const noexcept { return type != nullptr; }
+
+        bool accepts(port_type const & other) const noexcept {
+            return !is_typed() || !other.is_typed() || *type == *other.type;
+        }
+
+        bool same_as(port_type const & other) const noexcept {
+            return is_typed() == other.is_typed() && (!is_typed() || *type == *other.type);
+        }
+    };
+
+    template<class T, class Payload>
+        requires requires(Payload p) { { p.template emplace<T>() } -> std::same_as<T &>; }
+    port_type<Payload> port_of() noexcept {
+        return {
+            &typeid(T),
+            [](Payload & p) -> void * {
+                if(T * held = p.template get<T>(); held != nullptr)
+                    return held;
+                return &p.template emplace<T>();
+            },
+            [](Payload const & p) -> bool {
+                return p.template get<T>() != nullptr;
+            }
+        };
+    }
+
     template<class Payload>
 	struct linked_input {
 	    Payload const * maybe_value;
+
+        // The block counter of whatever feeds this input, see linked_output::produced.
+        size_t const * produced = nullptr;
+
+        port_type<Payload> type;
+
+        // Once linked to a typed output, points straight at the T inside the upstream payload.
+        void const * typed_value = nullptr;
+
+        // No optional or variant checks, only valid for typed slots.
+        template<class T>
+        T const & as() const noexcept {
+            return *static_cast<T const *>(typed_value);
+        }
 	};
 
     template<class Payload>
     struct linked_output {
         mutable Payload value;
         input_index<Payload> target_node;
+
+        // The block value was last computed for. A payload always holds something once it is typed,
+        // so this is what tells a downstream node whether it is looking at this block or an old one.
+        size_t produced = 0;
+
+        port_type<Payload> type;
+        void * typed_value = nullptr;
+
+        // Typed nodes write their result through here, in place, rather than assigning to value.
+        template<class T>
+        T & as() noexcept {
+            return *static_cast<T *>(typed_value);
+        }
     };
 
     template<OptionalVariantLike Payload>
@@ -78,6 +149,17 @@ namespace LazyDAW {
 
         mutable std::optional<std::function<computation_t>> maybe_function;
 
+        // How many samples late this node's output is relative to its input, e.g. lookahead or a
+        // buffered FFT frame. Used by ComputationGraph::compensate_latency.
+        size_t latency = 0;
+
+        // Bumped by every call to set, so a node that was given a new function can be told apart from
+        // one that merely kept its address.
+        size_t revision = 0;
+
+        // Set on the delay lines compensate_latency puts in, so it can redo them later.
+        bool compensation = false;
+
         public:
         VertexWithEdgeData() {
             input_slots.push_back(linked_input<Payload>());
@@ -121,11 +203,15 @@ namespace LazyDAW {
             return input_slots.at(i);
         }
 
-	    bool is_ready_to_compute() const noexcept {
+        void set_latency(size_t samples) noexcept { latency = samples; }
+        size_t peek_latency() const noexcept { return latency; }
+
+        // Ready once every input has been produced for this block.
+	    bool is_ready_to_compute(size_t block) const noexcept {
             bool is_ready = true;
 		    
             for(auto const &vertex : input_slots) {
-                is_ready &= vertex.maybe_value->has_value();
+                is_ready &= vertex.produced != nullptr && *vertex.produced == block;
             }
 
             is_ready &= maybe_function.has_value();
@@ -137,6 +223,8 @@ namespace LazyDAW {
             input_slots.clear();
             output_slots.clear();
             maybe_function.emplace(function);
+            ++revision;
+            compensation = false;
 
             input_slots.reserve(inputs);
             output_slots.reserve(outputs);
@@ -147,13 +235,45 @@ namespace LazyDAW {
                 output_slots.push_back(linked_output<Payload>());
         }
 
-        error compute() const noexcept {
+        // Typed version of set. Output payloads are made to hold their type right away, so the pointers
+        // handed out by link_node stay valid for as long as the node keeps that shape.
+        void set(std::vector<port_type<Payload>> const & inputs, std::vector<port_type<Payload>> const & outputs, std::function<computation_t> &&function) {
+            set(inputs.size(), outputs.size(), std::move(function));
+
+            for(size_t i = 0; i < inputs.size(); ++i)
+                input_slots[i].type = inputs[i];
+
+            for(size_t i = 0; i < outputs.size(); ++i)
+                retype_output(output_slots[i], outputs[i]);
+        }
+
+        static void retype_output(linked_output<Payload> & slot, port_type<Payload> type) {
+            slot.type = type;
+            slot.typed_value = type.is_typed() ? type.bind(slot.value) : nullptr;
+        }
+
+        // Returns whatever errors the node function reported, plus any found checking its outputs.
+        std::vector<error> compute(size_t block) const noexcept {
             using namespace std::string_literals;
-            if(!is_ready_to_compute())
-                return "Computation::VertexWithEdgeData::compute() called while vertex was not ready to compute."s;
+            if(!is_ready_to_compute(block))
+                return {"Computation::VertexWithEdgeData::compute() called while vertex was not ready to compute."s};
             else {
                 auto errs = (*maybe_function)(input_slots, output_slots);
-                return ""s;
+
+                for(auto & slot : output_slots)
+                    slot.produced = block;
+
+                // A node that assigned something of the wrong type to a typed output would leave the
+                // downstream pointers dangling. One check per slot per block, rather than one per access.
+                for(auto & slot : output_slots) {
+                    if(slot.type.is_typed() && !slot.type.holds(slot.value)) {
+                        slot.type.bind(slot.value);
+                        errs.push_back("Computation::VertexWithEdgeData::compute() produced a payload that does not match its output port."s);
+                        break;
+                    }
+                }
+
+                return errs;
             }
         }
 
@@ -163,12 +283,44 @@ namespace LazyDAW {
     class ComputationGraph {
         using node_t = VertexWithEdgeData<Payload>;
 
-        std::vector<node_t> interior_nodes;
+        // A deque rather than a vector so that adding a node never moves the ones already linked.
+        std::deque<node_t> interior_nodes;
 
         mutable node_t source;
         mutable node_t sink;
 
+        // Counts calls to compute, it is how nodes tell this block's inputs from the last one's.
+        mutable size_t block = 0;
+
+        // Topological order of the nodes reachable from the source, filled in by compensate_latency and
+        // thrown away by link_node. Nodes can also be changed behind the graph's
+        // back (set, set_latency), so each entry remembers what its node looked like.
+        struct scheduled_node {
+            node_t const * node;
+            size_t revision;
+            size_t latency;
+        };
+        std::vector<scheduled_node> schedule;
+        size_t total_latency = 0;
+
+        // The make_delay of the last compensate_latency, so an edited graph can be compensated again.
+        std::function<void(node_t &, size_t, port_type<Payload> const &)> delay_maker;
+
+        auto compute_scheduled() const noexcept {
+            std::vector<error> errors;
+
+            for(auto const & entry : schedule) {
+                auto node_errors = entry.node->compute(block);
+                std::move(node_errors.begin(), node_errors.end(), std::back_inserter(errors));
+            }
+
+            return errors;
+        }
+
         auto compute_graph() const noexcept {
+            if(is_compensated())
+                return compute_scheduled();
+
             jl::containers::set<node_t const *> this_depth;
             jl::containers::set<node_t const *> next_depth;
             std::vector<error> errors;
@@ -180,10 +332,8 @@ namespace LazyDAW {
             while((this_depth.find(&sink) == this_depth.end()) && !this_depth.empty()) {
                 
                 for( node_t const * node : this_depth ) {
-                    auto maybe_err = node->compute();
-
-                    if(!maybe_err.message.empty())
-                        errors.push_back(std::move(maybe_err));
+                    auto node_errors = node->compute(block);
+                    std::move(node_errors.begin(), node_errors.end(), std::back_inserter(errors));
 
                     for(auto & slot : node->output_slots) {
                         using namespace std::string_literals;
@@ -197,7 +347,7 @@ namespace LazyDAW {
 
                 std::sort(children.begin(), children.end());
                 std::unique(children.begin(), children.end());
-                std::erase_if(children, [](auto node_that_received_input){return !node_that_received_input->is_ready_to_compute();});
+                std::erase_if(children, [this](auto node_that_received_input){return !node_that_received_input->is_ready_to_compute(block);});
                 next_depth.insert_ordered_unique(std::move(children));
 
                 std::swap(this_depth, next_depth);
@@ -205,10 +355,9 @@ namespace LazyDAW {
                 next_depth.clear();
             }
 
-            if(sink.is_ready_to_compute()) {
-                auto maybe_err = sink.compute();
-                if(!maybe_err.message.empty())
-                    errors.push_back(std::move(maybe_err));
+            if(sink.is_ready_to_compute(block)) {
+                auto sink_errors = sink.compute(block);
+                std::move(sink_errors.begin(), sink_errors.end(), std::back_inserter(errors));
             }
             else {
                 using namespace std::string_literals;
@@ -222,6 +371,17 @@ namespace LazyDAW {
         public:
         ComputationGraph() = default;
 
+        // Typing the ends of the graph lets link_node catch a source or sink wired to the wrong node.
+        void set_source_type(port_type<Payload> type) {
+            source.input_slots.at(0).type = type;
+            node_t::retype_output(source.output_slots.at(0), type);
+        }
+
+        void set_sink_type(port_type<Payload> type) {
+            sink.input_slots.at(0).type = type;
+            node_t::retype_output(sink.output_slots.at(0), type);
+        }
+
         node_t & peek_source() noexcept { return source;}
         node_t & peek_sink() noexcept { return sink; }
         
@@ -229,7 +389,20 @@ namespace LazyDAW {
             return interior_nodes.at(i);
         }
 
-        std::vector<node_t> & peek_interior() noexcept { return interior_nodes; }
+        std::deque<node_t> & peek_interior() noexcept { return interior_nodes; }
+
+        // True while the graph is computed in the order compensate_latency worked out, i.e. nothing has
+        // been linked, added, set or had its latency changed since. Otherwise compute falls back to
+        // walking the graph depth by depth.
+        bool is_compensated() const noexcept {
+            return !schedule.empty() && std::all_of(schedule.begin(), schedule.end(), [](auto const & entry) {
+                return entry.node->revision == entry.revision && entry.node->latency == entry.latency;
+            });
+        }
+
+        // Latency of the whole graph in samples, as of the last compensate_latency. Only meaningful
+        // while is_compensated().
+        size_t peek_latency() const noexcept { return total_latency; }
 
 
         struct computation_result {
@@ -240,6 +413,7 @@ namespace LazyDAW {
         size_t add_interior_node() {
             auto index = interior_nodes.size();
 
+            // A node nobody links to is not on any path, the schedule stays as it is.
             interior_nodes.push_back(node_t());
 
             return index;
@@ -256,6 +430,7 @@ namespace LazyDAW {
 
         computation_result compute(Payload const & input) const noexcept {
             source.input_slots[0].maybe_value = std::addressof(input);
+            source.input_slots[0].produced = &++block;
             
             auto errors = compute_graph();
             auto optional_value = sink.output_slots[0].value;
@@ -263,20 +438,304 @@ namespace LazyDAW {
             return {std::move(errors), std::move(optional_value)};
         }
 
+        // Deep copy of the graph: same functions, same slot layout and same links, with pointers
+        // rewritten to refer to the nodes of the copy. carry(copy, original) is called for the value of
+        // every output slot, by default it copies the last computed value across.
+        //
+        // Node functions are copied as they are, so state they capture by pointer (e.g. the history of a
+        // delay line) is shared with the original rather than copied. That is what LiveComputationGraph
+        // wants, since only one of its graphs is computed at a time. Do not compute a clone alongside
+        // its original if either holds such nodes; rebuild the graph (or load it again) instead.
+        template<class Carry>
+        std::unique_ptr<ComputationGraph> clone(Carry && carry) const {
+            auto copy = std::make_unique<ComputationGraph>();
+
+            std::unordered_map<node_t const *, node_t *> image;
+            image.reserve(interior_nodes.size() + 2);
+
+            image.emplace(&source, &copy->source);
+            image.emplace(&sink, &copy->sink);
+
+            for(auto const & node : interior_nodes) {
+                copy->interior_nodes.push_back(node_t());
+                image.emplace(&node, &copy->interior_nodes.back());
+            }
+
+            for(auto [original, duplicate] : image) {
+                duplicate->input_slots.assign(original->input_slots.size(), linked_input<Payload>());
+                duplicate->output_slots.clear();
+                duplicate->output_slots.reserve(original->output_slots.size());
+
+                for(auto const & slot : original->output_slots) {
+                    duplicate->output_slots.push_back(linked_output<Payload>());
+                    carry(duplicate->output_slots.back().value, slot.value);
+                    node_t::retype_output(duplicate->output_slots.back(), slot.type);
+                }
+
+                for(size_t i = 0; i < original->input_slots.size(); ++i)
+                    duplicate->input_slots[i].type = original->input_slots[i].type;
+
+                duplicate->maybe_function = original->maybe_function;
+                duplicate->latency = original->latency;
+                duplicate->revision = original->revision;
+                duplicate->compensation = original->compensation;
+            }
+
+            for(auto [original, duplicate] : image) {
+                for(size_t i = 0; i < original->output_slots.size(); ++i) {
+                    auto target = original->output_slots[i].target_node;
+
+                    if(target.vertex == nullptr)
+                        continue;
+
+                    copy->link_node({duplicate, i}, {image.at(target.vertex), target.slot});
+                }
+            }
+
+            copy->schedule.reserve(schedule.size());
+            for(auto const & entry : schedule)
+                copy->schedule.push_back({image.at(entry.node), entry.revision, entry.latency});
+            copy->total_latency = total_latency;
+            copy->delay_maker = delay_maker;
+
+            return copy;
+        }
+
+        std::unique_ptr<ComputationGraph> clone() const {
+            return clone([](Payload & copy, Payload const & original) { copy = original; });
+        }
+
+        // Returns false if either slot does not exist, or if both are typed and the types differ.
         bool link_node(output_index<Payload> output, input_index<Payload> input) noexcept {
             try {
+                auto & out = to_slot(output);
+                auto & in = to_slot(input);
+
+                if(!in.type.accepts(out.type))
+                    return false;
+
+                // An untyped output feeding a typed input takes on the input's type.
+                if(!out.type.is_typed() && in.type.is_typed())
+                    node_t::retype_output(out, in.type);
+
+                in.typed_value = out.typed_value;
+
                 // Set the input's pointer to the optional VertexPayload
     	        to_slot(input).maybe_value = &(to_slot(output).value);
+                to_slot(input).produced = &(to_slot(output).produced);
 
                 // Set the target node of the slot in the output node to the input node to be linked.
                 to_slot(output).target_node = input;
 
+                schedule.clear();
                 return true;
             }
             catch(std::exception const & e) {
                 return false;
             }
         }
+
+        // Lines up every path through the graph. A node whose inputs arrive with different latencies
+        // gets a delay line in front of each earlier input, made by make_delay(node, samples, type) where
+        // type is the port type of the edge it goes on. Afterwards blocks are computed in topological
+        // order, so every node sees its inputs from the same block. Returns the latency of the graph.
+        //
+        // The delay lines are marked. Running it again after an edit works the paths out as if they were
+        // not there, then resizes, reuses or bypasses them, so the graph never holds more delay than it
+        // needs. All delay lines are made and checked before anything is relinked: if make_delay throws,
+        // or makes a node that does not fit its edge, the graph is left as it was.
+        template<class MakeDelay>
+        size_t compensate_latency(MakeDelay && make_delay) {
+            using namespace std::string_literals;
+
+            auto order = topological_order();
+
+            // Delay lines from an earlier run do not count, they are about to be redone.
+            auto latency_of = [](node_t const * node) { return node->compensation ? size_t(0) : node->latency; };
+
+            // Latency of the samples arriving at each node.
+            std::unordered_map<node_t const *, size_t> arrival;
+            arrival.reserve(order.size());
+
+            for(node_t * node : order) {
+                auto available = arrival[node] + latency_of(node);
+
+                for(auto const & slot : node->output_slots) {
+                    if(slot.target_node.vertex != nullptr) {
+                        auto & target = arrival[slot.target_node.vertex];
+                        target = std::max(target, available);
+                    }
+                }
+            }
+
+            // An edge between two ordinary nodes whose delay has to change, with the first delay line
+            // currently on it (if any) and the one replacing it (if it still needs one).
+            struct path_edge {
+                output_index<Payload> from;
+                input_index<Payload> to;
+                node_t * existing;
+                std::unique_ptr<node_t> replacement;
+            };
+            std::vector<path_edge> edges;
+
+            // Delay lines that end up on no path, free to be used for another edge.
+            std::vector<node_t *> spare;
+
+            for(auto & node : interior_nodes)
+                if(node.compensation && !arrival.contains(&node))
+                    spare.push_back(&node);
+
+            for(node_t * node : order) {
+                if(node->compensation)
+                    continue;
+
+                auto available = arrival[node] + latency_of(node);
+
+                for(size_t i = 0; i < node->output_slots.size(); ++i) {
+                    auto target = node->output_slots[i].target_node;
+                    std::vector<node_t *> chain;
+
+                    while(target.vertex != nullptr && target.vertex->compensation) {
+                        chain.push_back(target.vertex);
+                        target = target.vertex->output_slots.at(0).target_node;
+                    }
+
+                    if(target.vertex == nullptr)
+                        continue;
+
+                    auto samples = arrival[target.vertex] - available;
+
+                    if(chain.empty() ? samples == 0 : chain.size() == 1 && chain[0]->latency == samples)
+                        continue;
+
+                    path_edge edge{{node, i}, target, chain.empty() ? nullptr : chain[0], nullptr};
+
+                    if(samples > 0) {
+                        auto const & type = node->output_slots[i].type;
+
+                        edge.replacement = std::make_unique<node_t>();
+                        auto & delay = *edge.replacement;
+                        make_delay(delay, samples, type);
+
+                        if(delay.input_slots.empty() || delay.output_slots.empty()
+                            || !delay.input_slots[0].type.accepts(type)
+                            || !to_slot(target).type.accepts(delay.output_slots[0].type))
+                            throw std::runtime_error("ComputationGraph::compensate_latency() got a delay line that does not fit its edge, mismatched port types."s);
+
+                        delay.latency = samples;
+                        delay.compensation = true;
+                    }
+
+                    // Whatever else was on the edge drops out.
+                    for(size_t c = edge.replacement ? 1 : 0; c < chain.size(); ++c)
+                        spare.push_back(chain[c]);
+
+                    edges.push_back(std::move(edge));
+                }
+            }
+
+            // Nothing has been touched up to here.
+            for(auto & edge : edges)
+                if(!edge.replacement)
+                    link_node(edge.from, edge.to);
+
+            for(node_t * node : spare)
+                for(auto & slot : node->output_slots)
+                    slot.target_node = {nullptr, 0};
+
+            for(auto & edge : edges) {
+                if(!edge.replacement)
+                    continue;
+
+                node_t * delay = edge.existing;
+
+                if(delay == nullptr && !spare.empty()) {
+                    delay = spare.back();
+                    spare.pop_back();
+                }
+
+                if(delay == nullptr) {
+                    interior_nodes.push_back(std::move(*edge.replacement));
+                    delay = &interior_nodes.back();
+                }
+                else {
+                    auto revision = delay->revision;
+                    *delay = std::move(*edge.replacement);
+                    delay->revision = revision + 1;
+                }
+
+                link_node(edge.from, {delay, 0});
+                link_node({delay, 0}, edge.to);
+            }
+
+            auto compiled = topological_order();
+
+            schedule.clear();
+            for(node_t const * node : compiled)
+                schedule.push_back({node, node->revision, node->latency});
+            total_latency = arrival[&sink] + latency_of(&sink);
+
+            delay_maker = std::forward<MakeDelay>(make_delay);
+
+            return total_latency;
+        }
+
+        // Compensates again with the make_delay used last time, e.g. after relinking a graph that had
+        // been compensated.
+        size_t compensate_latency() {
+            using namespace std::string_literals;
+
+            if(!delay_maker)
+                throw std::runtime_error("ComputationGraph::compensate_latency() has no make_delay to reuse, the graph was never compensated."s);
+
+            return compensate_latency(delay_maker);
+        }
+
+        private:
+        // Kahn's algorithm over the nodes reachable from the source.
+        std::vector<node_t *> topological_order() {
+            using namespace std::string_literals;
+
+            std::unordered_map<node_t *, size_t> pending_inputs;
+            std::vector<node_t *> stack = {&source};
+
+            pending_inputs.emplace(&source, 0);
+
+            while(!stack.empty()) {
+                auto node = stack.back();
+                stack.pop_back();
+
+                for(auto const & slot : node->output_slots) {
+                    if(slot.target_node.vertex == nullptr)
+                        continue;
+
+                    auto [it, first_visit] = pending_inputs.try_emplace(slot.target_node.vertex, 0);
+                    ++it->second;
+
+                    if(first_visit)
+                        stack.push_back(slot.target_node.vertex);
+                }
+            }
+
+            if(!pending_inputs.contains(&sink))
+                throw std::runtime_error("ComputationGraph::compensate_latency() found no path from the source to the sink."s);
+
+            std::vector<node_t *> order;
+            order.reserve(pending_inputs.size());
+            order.push_back(&source);
+
+            for(size_t next = 0; next < order.size(); ++next) {
+                for(auto const & slot : order[next]->output_slots) {
+                    if(slot.target_node.vertex != nullptr && --pending_inputs[slot.target_node.vertex] == 0)
+                        order.push_back(slot.target_node.vertex);
+                }
+            }
+
+            if(order.size() != pending_inputs.size())
+                throw std::runtime_error("ComputationGraph::compensate_latency() found a cycle."s);
+
+            return order;
+        }
     };
 
 }
\ No newline at end of file
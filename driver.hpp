@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "lazydaw.hpp"
+
+
+namespace LazyDAW {
+
+    // A stand in for an audio device, so the real time behaviour of a graph can be checked without a
+    // sound card (e.g. in CI). The driver pulls one block at a time through the graph on its own thread,
+    // paced by a fake device clock, and records how well it kept up.
+
+    // Where the device gets its input block from.
+    template<class T>
+    concept BlockSource = requires(T t, AudioSample & block, size_t frames) {
+        t.read(block, frames);
+    };
+
+    // Where the device sends the processed block.
+    template<class T>
+    concept BlockSink = requires(T t, AudioSample const & block) {
+        t.write(block);
+    };
+
+    struct SilenceSource {
+        void read(AudioSample & block, size_t frames) {
+            block.zero_out(frames);
+        }
+    };
+
+    // Plays a sample already in memory, padding with silence once it runs out.
+    struct SampleSource {
+        AudioSample const * sample;
+        size_t position = 0;
+
+        void read(AudioSample & block, size_t frames) {
+            block.zero_out(frames);
+
+            auto available = std::min(frames, sample->size() - std::min(position, sample->size()));
+            std::copy_n(sample->begin() + position, available, block.begin());
+            position += available;
+        }
+    };
+
+    struct NullSink {
+        void write(AudioSample const &) noexcept { }
+    };
+
+    // Raw little endian int16_t, no header.
+    struct FileSink {
+        std::ofstream file;
+
+        explicit FileSink(std::string const & path)
+            : file(path, std::ios::binary | std::ios::out) {
+            if(!file)
+                throw std::runtime_error("FileSink could not open " + path);
+        }
+
+        void write(AudioSample const & block) {
+            file.write(reinterpret_cast<char const *>(block.data()), block.size() * sizeof(int16_t));
+        }
+    };
+
+    // The device clock. It ticks once per block and never waits for anybody: block n is due to be
+    // handed to the graph at deadline(n) and must be finished by deadline(n+1).
+    struct SimulatedDeviceClock {
+        using clock = std::chrono::steady_clock;
+
+        clock::time_point start;
+        clock::duration period;
+
+        SimulatedDeviceClock(size_t sample_rate, size_t block_frames)
+            : start(clock::now()),
+            period(std::chrono::duration_cast<clock::duration>(
+                std::chrono::duration<double>(static_cast<double>(block_frames) / static_cast<double>(sample_rate)))) { }
+
+        clock::time_point deadline(size_t block) const noexcept {
+            return start + static_cast<clock::rep>(block) * period;
+        }
+    };
+
+    struct DriverSettings {
+        size_t sample_rate = 44100;
+        size_t block_frames = 256;
+
+        // If false the driver does not sleep between blocks. Load and xruns are still measured against
+        // the block period, which is handy when a test only cares about headroom and not wall time.
+        bool real_time_pacing = true;
+
+        // Ask the OS for a real time scheduling class for the driver thread. Usually needs privileges,
+        // failure is recorded in DriverStatistics and otherwise ignored.
+        bool raise_priority = true;
+    };
+
+    struct DriverStatistics {
+        using duration = std::chrono::duration<double, std::micro>;
+
+        size_t blocks = 0;
+        size_t xruns = 0;
+        size_t failed_blocks = 0;
+
+        // Lateness of the wake up relative to the device clock.
+        duration max_jitter{0};
+        duration total_jitter{0};
+
+        // Time spent producing a block, as a fraction of the block period.
+        double max_load = 0.;
+        double total_load = 0.;
+
+        bool got_real_time_priority = false;
+
+        duration mean_jitter() const noexcept {
+            return blocks == 0 ? duration(0) : total_jitter / static_cast<double>(blocks);
+        }
+
+        double mean_load() const noexcept {
+            return blocks == 0 ? 0. : total_load / static_cast<double>(blocks);
+        }
+
+        // How much of the worst block period was left over.
+        double headroom() const noexcept {
+            return 1. - max_load;
+        }
+    };
+
+    // Graph is anything with compute(AudioRepresentation const &) returning errors and result, that is
+    // a ComputationGraph<AudioRepresentation> or a LiveComputationGraph<AudioRepresentation>.
+    template<class Graph>
+    class SimulatedDriver {
+        Graph & graph;
+        DriverSettings settings;
+        std::atomic<bool> stop_requested;
+
+        static bool raise_thread_priority() noexcept {
+#if defined(__unix__) || defined(__APPLE__)
+            sched_param param{};
+            param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+            return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#else
+            return false;
+#endif
+        }
+
+        template<BlockSource Source, BlockSink Sink>
+        void process(Source & source, Sink & sink, size_t block_count, DriverStatistics & stats) {
+            using clock = SimulatedDeviceClock::clock;
+
+            if(settings.raise_priority)
+                stats.got_real_time_priority = raise_thread_priority();
+
+            SimulatedDeviceClock device(settings.sample_rate, settings.block_frames);
+
+            // Filled in place every cycle, so nothing is allocated inside the timed window.
+            AudioRepresentation input;
+            auto & block = input.template emplace<AudioSample>();
+            block.reserve(settings.block_frames);
+
+            for(size_t n = 0; n < block_count && !stop_requested.load(std::memory_order_relaxed); ++n) {
+                auto scheduled = device.deadline(n);
+
+                if(settings.real_time_pacing)
+                    std::this_thread::sleep_until(scheduled);
+
+                auto woke = clock::now();
+                if(!settings.real_time_pacing)
+                    scheduled = woke;
+
+                source.read(block, settings.block_frames);
+                auto result = graph.compute(input);
+
+                if(auto const * output = result.result.template get<AudioSample>(); result.errors.empty() && output != nullptr)
+                    sink.write(*output);
+                else
+                    ++stats.failed_blocks;
+
+                auto done = clock::now();
+
+                DriverStatistics::duration jitter = std::max(woke - scheduled, clock::duration::zero());
+                double load = std::chrono::duration<double>(done - woke) / std::chrono::duration<double>(device.period);
+
+                ++stats.blocks;
+                stats.total_jitter += jitter;
+                stats.max_jitter = std::max(stats.max_jitter, jitter);
+                stats.total_load += load;
+                stats.max_load = std::max(stats.max_load, load);
+
+                if(done > scheduled + device.period)
+                    ++stats.xruns;
+            }
+        }
+
+        public:
+        SimulatedDriver(Graph & graph, DriverSettings settings = {})
+            : graph(graph),
+            settings(settings),
+            stop_requested(false) { }
+
+        // Runs block_count blocks on a dedicated thread and waits for it. Safe to cut short from another
+        // thread with stop().
+        template<BlockSource Source, BlockSink Sink>
+        DriverStatistics run(Source & source, Sink & sink, size_t block_count) {
+            DriverStatistics stats;
+
+            std::thread device_thread([&]() { process(source, sink, block_count, stats); });
+            device_thread.join();
+
+            // Reset here rather than on the way in, so a stop() that races the start of run() still counts.
+            stop_requested.store(false);
+
+            return stats;
+        }
+
+        void stop() noexcept {
+            stop_requested.store(true);
+        }
+
+        DriverSettings const & peek_settings() const noexcept { return settings; }
+    };
+
+}
@@ -0,0 +1,359 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <complex>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <memory>
+#include <numbers>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "lazydaw.hpp"
+
+
+namespace LazyDAW {
+
+    inline size_t next_power_of_two(size_t n) noexcept {
+        return std::bit_ceil(std::max<size_t>(n, 1));
+    }
+
+    namespace detail {
+
+        // One radix 2 stage over a run of 2*half points: a[k] and a[k+half] are combined with twiddle[k].
+        template<std::floating_point Real>
+        inline void butterflies(std::complex<Real> * a, std::complex<Real> const * twiddle, size_t half) noexcept {
+            size_t k = 0;
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+            if constexpr (std::is_same_v<Real, float>) {
+                // std::complex<float> is layout compatible with float[2], so a register of 2n floats holds n
+                // interleaved complex numbers. The product v*t is done as
+                // (vr*tr - vi*ti, vi*tr + vr*ti) = addsub(v * tr, swap(v) * ti).
+                float * re_im = reinterpret_cast<float *>(a);
+                float const * w = reinterpret_cast<float const *>(twiddle);
+#if defined(__AVX512F__)
+                for(; k + 8 <= half; k += 8) {
+                    __m512 u = _mm512_loadu_ps(re_im + 2*k);
+                    __m512 v = _mm512_loadu_ps(re_im + 2*(k + half));
+                    __m512 t = _mm512_loadu_ps(w + 2*k);
+
+                    __m512 v_swapped = _mm512_permute_ps(v, 0xB1);
+                    __m512 vt = _mm512_fmaddsub_ps(v, _mm512_moveldup_ps(t), _mm512_mul_ps(v_swapped, _mm512_movehdup_ps(t)));
+
+                    _mm512_storeu_ps(re_im + 2*k, _mm512_add_ps(u, vt));
+                    _mm512_storeu_ps(re_im + 2*(k + half), _mm512_sub_ps(u, vt));
+                }
+#endif
+#if defined(__AVX2__)
+                for(; k + 4 <= half; k += 4) {
+                    __m256 u = _mm256_loadu_ps(re_im + 2*k);
+                    __m256 v = _mm256_loadu_ps(re_im + 2*(k + half));
+                    __m256 t = _mm256_loadu_ps(w + 2*k);
+
+                    __m256 v_swapped = _mm256_permute_ps(v, 0xB1);
+                    __m256 vt = _mm256_addsub_ps(_mm256_mul_ps(v, _mm256_moveldup_ps(t)), _mm256_mul_ps(v_swapped, _mm256_movehdup_ps(t)));
+
+                    _mm256_storeu_ps(re_im + 2*k, _mm256_add_ps(u, vt));
+                    _mm256_storeu_ps(re_im + 2*(k + half), _mm256_sub_ps(u, vt));
+                }
+#endif
+            }
+#endif
+
+            for(; k < half; ++k) {
+                auto u = a[k];
+                auto v = a[k + half] * twiddle[k];
+                a[k] = u + v;
+                a[k + half] = u - v;
+            }
+        }
+
+        // Calls f(begin, end) on contiguous chunks of [0, count), one chunk per thread.
+        template<class F>
+        void parallel_for(size_t count, unsigned threads, F && f) {
+            threads = static_cast<unsigned>(std::min<size_t>(std::max(threads, 1u), count));
+
+            if(threads <= 1) {
+                f(size_t(0), count);
+                return;
+            }
+
+            std::vector<std::jthread> workers;
+            workers.reserve(threads - 1);
+
+            size_t chunk = (count + threads - 1) / threads;
+            for(size_t begin = chunk; begin < count; begin += chunk)
+                workers.emplace_back([&f, begin, end = std::min(count, begin + chunk)]() { f(begin, end); });
+
+            f(size_t(0), std::min(count, chunk));
+        }
+
+        // out is the cols x rows transpose of the rows x cols matrix in. Done in square tiles so both the
+        // reads and the writes stay within a few cache lines at a time.
+        template<class T>
+        void blocked_transpose(T const * in, T * out, size_t rows, size_t cols, unsigned threads) {
+            constexpr size_t tile = 32;
+
+            parallel_for((rows + tile - 1) / tile, threads, [=](size_t first_tile, size_t last_tile) {
+                for(size_t r0 = first_tile * tile; r0 < std::min(rows, last_tile * tile); r0 += tile) {
+                    for(size_t c0 = 0; c0 < cols; c0 += tile) {
+                        for(size_t r = r0; r < std::min(rows, r0 + tile); ++r)
+                            for(size_t c = c0; c < std::min(cols, c0 + tile); ++c)
+                                out[c*rows + r] = in[r*cols + c];
+                    }
+                }
+            });
+        }
+    }
+
+    // A precomputed FFT of a fixed power of two length. Building the plan does all the trigonometry
+    // up front, so a node should build one and reuse it for every block.
+    //
+    // Short transforms are a plain radix 2 FFT. Once the data no longer fits in cache (say a whole track
+    // going through main.cpp's FFT -> filter -> IFFT chain) the plan switches to the six step algorithm:
+    // n = rows * columns, and the transform becomes short FFTs over the rows of a matrix, separated by
+    // twiddle multiplications and cache blocked transposes. The short FFTs and the transposes are spread
+    // over several threads.
+    template<std::floating_point Real>
+    class FourierPlan {
+        public:
+        using coefficients_t = BasicFourierCoefficients<Real>;
+        using complex = std::complex<Real>;
+
+        static constexpr size_t large_transform_threshold = size_t(1) << 18;
+
+        private:
+        size_t length;
+        unsigned threads;
+        std::vector<uint32_t> bit_reversal;
+
+        // Stage with half size h uses twiddles[h-1 .. 2h-1), i.e. exp(-i pi k / h) for k < h. Laid out
+        // contiguously so the butterflies read them with unit stride.
+        std::vector<complex> twiddles;
+
+        // Six step only. The input is read as a columns x rows matrix (rows points apart), and
+        // exp(-2 pi i m / n) for m < n is coarse_twiddles[m / columns] * fine_twiddles[m % columns].
+        size_t rows = 0;
+        size_t columns = 0;
+        std::shared_ptr<FourierPlan const> row_plan;
+        std::shared_ptr<FourierPlan const> column_plan;
+        std::vector<complex> coarse_twiddles;
+        std::vector<complex> fine_twiddles;
+
+        void transform(complex * a) const {
+            if(row_plan)
+                six_step_transform(a);
+            else
+                radix_2_transform(a);
+        }
+
+        void six_step_transform(complex * a) const {
+            std::vector<complex> scratch(length);
+
+            // 1. x[j1 + rows*j2] sits at row j2, column j1. Transposing puts each j1 on its own row.
+            detail::blocked_transpose(a, scratch.data(), columns, rows, threads);
+
+            // 2 and 3. FFT of length columns over each row j1, then the twiddle exp(-2 pi i j1 k2 / n).
+            detail::parallel_for(rows, threads, [&](size_t first, size_t last) {
+                for(size_t j1 = first; j1 < last; ++j1) {
+                    complex * row = scratch.data() + j1*columns;
+                    row_plan->transform(row);
+
+                    for(size_t k2 = 1; k2 < columns; ++k2) {
+                        size_t m = j1 * k2;
+                        row[k2] *= coarse_twiddles[m / columns] * fine_twiddles[m % columns];
+                    }
+                }
+            });
+
+            // 4 and 5. Back to one row per k2, FFT of length rows over each.
+            detail::blocked_transpose(scratch.data(), a, rows, columns, threads);
+
+            detail::parallel_for(columns, threads, [&](size_t first, size_t last) {
+                for(size_t k2 = first; k2 < last; ++k2)
+                    column_plan->transform(a + k2*rows);
+            });
+
+            // 6. X[k2 + columns*k1] is at row k2, column k1; transpose into natural order.
+            detail::blocked_transpose(a, scratch.data(), columns, rows, threads);
+            std::copy(scratch.begin(), scratch.end(), a);
+        }
+
+        void radix_2_transform(complex * a) const noexcept {
+            for(size_t i = 0; i < length; ++i) {
+                if(i < bit_reversal[i])
+                    std::swap(a[i], a[bit_reversal[i]]);
+            }
+
+            for(size_t half = 1; half < length; half *= 2) {
+                complex const * stage_twiddles = twiddles.data() + (half - 1);
+
+                for(size_t start = 0; start < length; start += 2*half)
+                    detail::butterflies<Real>(a + start, stage_twiddles, half);
+            }
+        }
+
+        // Fills out with count entries, either taken from the front of precomputed or made by generate.
+        template<class Generator>
+        static void fill_table(std::vector<complex> & out, size_t count, std::span<complex const> * precomputed, Generator generate) {
+            out.resize(count);
+
+            if(precomputed == nullptr) {
+                for(size_t i = 0; i < count; ++i)
+                    out[i] = generate(i);
+                return;
+            }
+
+            if(precomputed->size() < count)
+                throw std::invalid_argument("FourierPlan table is too short for the requested length.");
+
+            std::copy_n(precomputed->begin(), count, out.begin());
+            *precomputed = precomputed->subspan(count);
+        }
+
+        FourierPlan(size_t length, unsigned threads, std::span<complex const> * precomputed)
+            : length(length),
+            threads(threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency())) {
+            if(length == 0 || !std::has_single_bit(length))
+                throw std::invalid_argument("FourierPlan length must be a power of two.");
+
+            auto bits = std::countr_zero(length);
+
+            if(length >= large_transform_threshold) {
+                rows = size_t(1) << (bits / 2);
+                columns = length / rows;
+
+                auto unit = -2. * std::numbers::pi_v<double> / static_cast<double>(length);
+                fill_table(coarse_twiddles, rows, precomputed, [=, this](size_t s) {
+                    return complex(std::polar(1., unit * static_cast<double>(s * columns)));
+                });
+                fill_table(fine_twiddles, columns, precomputed, [=](size_t t) {
+                    return complex(std::polar(1., unit * static_cast<double>(t)));
+                });
+
+                row_plan.reset(new FourierPlan(columns, 1, precomputed));
+                column_plan.reset(new FourierPlan(rows, 1, precomputed));
+
+                return;
+            }
+
+            bit_reversal.resize(length);
+
+            for(size_t i = 0; i < length; ++i) {
+                uint32_t reversed = 0;
+                for(int b = 0; b < bits; ++b)
+                    reversed |= ((i >> b) & 1u) << (bits - 1 - b);
+                bit_reversal[i] = reversed;
+            }
+
+            // Computed in double whatever Real is, so the float plan is not any less accurate than it has to be.
+            twiddles.reserve(length - 1);
+            for(size_t half = 1; half < length; half *= 2) {
+                std::vector<complex> stage;
+                fill_table(stage, half, precomputed, [half](size_t k) {
+                    auto angle = -std::numbers::pi_v<double> * static_cast<double>(k) / static_cast<double>(half);
+                    return complex(static_cast<Real>(std::cos(angle)), static_cast<Real>(std::sin(angle)));
+                });
+                twiddles.insert(twiddles.end(), stage.begin(), stage.end());
+            }
+        }
+
+        void append_table(std::vector<complex> & out) const {
+            if(row_plan) {
+                out.insert(out.end(), coarse_twiddles.begin(), coarse_twiddles.end());
+                out.insert(out.end(), fine_twiddles.begin(), fine_twiddles.end());
+                row_plan->append_table(out);
+                column_plan->append_table(out);
+            }
+            else
+                out.insert(out.end(), twiddles.begin(), twiddles.end());
+        }
+
+        public:
+        // threads only matters for large transforms, 0 means one per hardware thread.
+        explicit FourierPlan(size_t length, unsigned threads = 0)
+            : FourierPlan(length, threads, nullptr) { }
+
+        // Rebuilds a plan from the output of table(), e.g. one stored in a saved graph, without doing
+        // any trigonometry.
+        FourierPlan(size_t length, std::span<complex const> table, unsigned threads = 0)
+            : FourierPlan(length, threads, &table) {
+            if(!table.empty())
+                throw std::invalid_argument("FourierPlan table is too long for the requested length.");
+        }
+
+        // Every precomputed constant the plan uses, flattened.
+        std::vector<complex> table() const {
+            std::vector<complex> out;
+            append_table(out);
+            return out;
+        }
+
+        size_t size() const noexcept { return length; }
+
+        // In place. data must hold exactly size() coefficients.
+        void forward(coefficients_t & data) const {
+            if(data.size() != length)
+                throw std::invalid_argument("FourierPlan::forward called with the wrong number of coefficients.");
+
+            transform(data.data());
+        }
+
+        // In place and normalized, so inverse(forward(x)) == x.
+        void inverse(coefficients_t & data) const {
+            if(data.size() != length)
+                throw std::invalid_argument("FourierPlan::inverse called with the wrong number of coefficients.");
+
+            // ifft(x) = conj(fft(conj(x))) / n, which saves a second twiddle table.
+            for(auto & c : data)
+                c = std::conj(c);
+
+            transform(data.data());
+
+            Real scale = Real(1) / static_cast<Real>(length);
+            for(auto & c : data)
+                c = std::conj(c) * scale;
+        }
+
+        // Transform of a block of samples, zero padded (or truncated) to size().
+        coefficients_t forward(AudioSample const & amplitudes) const {
+            coefficients_t f;
+            f.zero_out(length);
+
+            auto count = std::min(length, amplitudes.size());
+            for(size_t i = 0; i < count; ++i)
+                f[i] = complex(static_cast<Real>(amplitudes[i]), 0);
+
+            transform(f.data());
+
+            return f;
+        }
+
+        // Back to samples, keeping the real part rounded and clamped to the int16_t range.
+        AudioSample inverse_to_samples(coefficients_t const & frequencies) const {
+            coefficients_t f = frequencies;
+            inverse(f);
+
+            AudioSample approx;
+            approx.zero_out(length);
+
+            for(size_t i = 0; i < length; ++i) {
+                auto clamped = std::clamp(std::round(f[i].real()), static_cast<Real>(INT16_MIN), static_cast<Real>(INT16_MAX));
+                approx[i] = static_cast<int16_t>(clamped);
+            }
+
+            return approx;
+        }
+    };
+
+}
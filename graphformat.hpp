@@ -0,0 +1,378 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "computationgraph.hpp"
+
+
+namespace LazyDAW {
+
+    // Saving and loading graphs.
+    //
+    // A node's function cannot be written to disk, so a saved node is a type name plus the data needed
+    // to rebuild it: a list of parameters and an optional binary table holding whatever is expensive to
+    // recompute (FFT twiddles, the spectrum of an impulse response, ...). A NodeRegistry maps the type
+    // name back to code.
+    //
+    // The file is laid out so it can be mapped and used in place: a fixed size header, an array of node
+    // records, an array of links, then a blob with the type names, parameters and tables. Everything in
+    // the blob is 16 byte aligned and referred to by offset from the start of the file, so tables are
+    // handed to the node factories as spans into the mapping rather than being copied out first.
+    //
+    // Nodes are numbered 0 for the source, 1 for the sink, and 2 + i for interior node i.
+
+    struct NodeDescription {
+        std::string type;
+        std::vector<double> parameters;
+        std::vector<std::byte> table;
+    };
+
+    struct LinkDescription {
+        uint32_t from_node;
+        uint32_t from_slot;
+        uint32_t to_node;
+        uint32_t to_slot;
+    };
+
+    struct GraphDescription {
+        static constexpr uint32_t source = 0;
+        static constexpr uint32_t sink = 1;
+        static constexpr uint32_t first_interior = 2;
+
+        std::vector<NodeDescription> nodes;
+        std::vector<LinkDescription> links;
+
+        // Returns the number to use for the new node in links.
+        uint32_t add_node(NodeDescription node) {
+            nodes.push_back(std::move(node));
+            return first_interior + static_cast<uint32_t>(nodes.size() - 1);
+        }
+
+        void link(uint32_t from_node, uint32_t from_slot, uint32_t to_node, uint32_t to_slot) {
+            links.push_back({from_node, from_slot, to_node, to_slot});
+        }
+    };
+
+    template<class T>
+    std::vector<std::byte> to_table(std::span<T const> values) {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        std::vector<std::byte> table(values.size_bytes());
+        std::memcpy(table.data(), values.data(), values.size_bytes());
+        return table;
+    }
+
+    namespace graph_format {
+        inline constexpr char magic[8] = {'L', 'A', 'Z', 'Y', 'G', 'R', 'P', 'H'};
+        inline constexpr uint32_t version = 1;
+        inline constexpr uint32_t byte_order_mark = 0x01020304;
+        inline constexpr size_t alignment = 16;
+
+        struct header {
+            char magic[8];
+            uint32_t version;
+            uint32_t byte_order_mark;
+            uint32_t node_count;
+            uint32_t link_count;
+            uint64_t nodes_offset;
+            uint64_t links_offset;
+            uint64_t file_size;
+        };
+
+        struct node_record {
+            uint64_t type_offset;
+            uint64_t parameters_offset;
+            uint64_t table_offset;
+            uint64_t table_size;
+            uint32_t type_length;
+            uint32_t parameter_count;
+        };
+
+        using link_record = LinkDescription;
+
+        static_assert(std::is_trivially_copyable_v<header> && sizeof(header) == 48);
+        static_assert(std::is_trivially_copyable_v<node_record> && sizeof(node_record) == 40);
+        static_assert(std::is_trivially_copyable_v<link_record> && sizeof(link_record) == 16);
+
+        inline size_t align_up(size_t offset) noexcept {
+            return (offset + alignment - 1) & ~(alignment - 1);
+        }
+    }
+
+    // The bytes of the graph file for graph.
+    inline std::vector<std::byte> serialize(GraphDescription const & graph) {
+        using namespace graph_format;
+
+        std::vector<std::byte> out(sizeof(header));
+
+        auto append = [&out](void const * data, size_t size) -> uint64_t {
+            auto offset = align_up(out.size());
+            out.resize(offset + size);
+            if(size != 0)
+                std::memcpy(out.data() + offset, data, size);
+            return offset;
+        };
+
+        std::vector<node_record> records;
+        records.reserve(graph.nodes.size());
+
+        for(auto const & node : graph.nodes) {
+            node_record r{};
+            r.type_length = static_cast<uint32_t>(node.type.size());
+            r.type_offset = append(node.type.data(), node.type.size());
+            r.parameter_count = static_cast<uint32_t>(node.parameters.size());
+            r.parameters_offset = append(node.parameters.data(), node.parameters.size() * sizeof(double));
+            r.table_size = node.table.size();
+            r.table_offset = append(node.table.data(), node.table.size());
+            records.push_back(r);
+        }
+
+        header h{};
+        std::memcpy(h.magic, magic, sizeof(magic));
+        h.version = version;
+        h.byte_order_mark = byte_order_mark;
+        h.node_count = static_cast<uint32_t>(records.size());
+        h.link_count = static_cast<uint32_t>(graph.links.size());
+        h.nodes_offset = append(records.data(), records.size() * sizeof(node_record));
+        h.links_offset = append(graph.links.data(), graph.links.size() * sizeof(link_record));
+
+        out.resize(align_up(out.size()));
+        h.file_size = out.size();
+        std::memcpy(out.data(), &h, sizeof(h));
+
+        return out;
+    }
+
+    // A node of a serialized graph. Everything points into the underlying bytes.
+    struct NodeView {
+        std::string_view type;
+        std::span<double const> parameters;
+        std::span<std::byte const> table;
+
+        // The table reinterpreted as an array of T, e.g. std::complex<float> twiddles.
+        template<class T>
+        std::span<T const> table_as() const {
+            static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= graph_format::alignment);
+
+            if(table.size() % sizeof(T) != 0)
+                throw std::runtime_error("Graph node table size is not a multiple of the element size.");
+            return {reinterpret_cast<T const *>(table.data()), table.size() / sizeof(T)};
+        }
+    };
+
+    // Checked, zero copy view of a serialized graph. The bytes must outlive the view and be at least
+    // 16 byte aligned, which both a memory mapping and operator new give.
+    class GraphView {
+        std::span<std::byte const> bytes;
+        graph_format::header h;
+
+        template<class T>
+        std::span<T const> section(uint64_t offset, uint64_t count) const {
+            if(offset % alignof(T) != 0 || offset > bytes.size() || count > (bytes.size() - offset) / sizeof(T))
+                throw std::runtime_error("Graph file is truncated or has a section out of bounds.");
+            return {reinterpret_cast<T const *>(bytes.data() + offset), static_cast<size_t>(count)};
+        }
+
+        public:
+        explicit GraphView(std::span<std::byte const> bytes) : bytes(bytes) {
+            using namespace graph_format;
+
+            if(bytes.size() < sizeof(header))
+                throw std::runtime_error("Graph file is too short to hold a header.");
+            if(reinterpret_cast<std::uintptr_t>(bytes.data()) % alignment != 0)
+                throw std::runtime_error("Graph file buffer is not aligned.");
+
+            std::memcpy(&h, bytes.data(), sizeof(h));
+
+            if(std::memcmp(h.magic, magic, sizeof(magic)) != 0)
+                throw std::runtime_error("Not a LazyDAW graph file.");
+            if(h.byte_order_mark != byte_order_mark)
+                throw std::runtime_error("Graph file was written on a machine with a different byte order.");
+            if(h.version != version)
+                throw std::runtime_error("Unsupported graph file version " + std::to_string(h.version) + ".");
+            if(h.file_size > bytes.size())
+                throw std::runtime_error("Graph file is truncated.");
+            if(h.file_size < sizeof(header))
+                throw std::runtime_error("Graph file is too short to hold a header.");
+
+            // Anything after the recorded end of the file is not part of it, sections must not reach it.
+            this->bytes = bytes.first(static_cast<size_t>(h.file_size));
+
+            section<node_record>(h.nodes_offset, h.node_count);
+            section<link_record>(h.links_offset, h.link_count);
+        }
+
+        size_t node_count() const noexcept { return h.node_count; }
+
+        NodeView node(size_t i) const {
+            auto const & r = section<graph_format::node_record>(h.nodes_offset, h.node_count)[i];
+
+            auto type = section<char>(r.type_offset, r.type_length);
+            return {
+                std::string_view(type.data(), type.size()),
+                section<double>(r.parameters_offset, r.parameter_count),
+                section<std::byte>(r.table_offset, r.table_size)
+            };
+        }
+
+        std::span<LinkDescription const> links() const {
+            return section<graph_format::link_record>(h.links_offset, h.link_count);
+        }
+    };
+
+    // Maps node type names to code that turns a NodeView into a working node, typically by calling
+    // node.set(inputs, outputs, function). The view may point into a mapping that goes away once loading
+    // is done, so a factory has to copy whatever it wants to keep.
+    template<OptionalVariantLike Payload>
+    class NodeRegistry {
+        public:
+        using node_t = VertexWithEdgeData<Payload>;
+        using factory_t = std::function<void(node_t &, NodeView const &)>;
+
+        private:
+        std::unordered_map<std::string, factory_t> factories;
+
+        public:
+        void add(std::string type, factory_t factory) {
+            factories.insert_or_assign(std::move(type), std::move(factory));
+        }
+
+        bool contains(std::string_view type) const {
+            return factories.contains(std::string(type));
+        }
+
+        void build(node_t & node, NodeView const & description) const {
+            auto it = factories.find(std::string(description.type));
+            if(it == factories.end())
+                throw std::runtime_error("Unknown node type \"" + std::string(description.type) + "\" in graph file.");
+            it->second(node, description);
+        }
+    };
+
+    // Builds a ready to run graph straight from a view, tables are read in place.
+    template<OptionalVariantLike Payload>
+    std::unique_ptr<ComputationGraph<Payload>> instantiate(GraphView const & view, NodeRegistry<Payload> const & registry) {
+        auto graph = std::make_unique<ComputationGraph<Payload>>();
+
+        for(size_t i = 0; i < view.node_count(); ++i) {
+            auto index = graph->add_interior_node();
+            registry.build(graph->peek_inner(index), view.node(i));
+        }
+
+        auto node_at = [&graph](uint32_t n) -> VertexWithEdgeData<Payload> * {
+            if(n == GraphDescription::source)
+                return &graph->peek_source();
+            if(n == GraphDescription::sink)
+                return &graph->peek_sink();
+            if(n - GraphDescription::first_interior >= graph->peek_interior().size())
+                throw std::runtime_error("Graph file links a node that does not exist.");
+            return &graph->peek_inner(n - GraphDescription::first_interior);
+        };
+
+        for(auto const & link : view.links()) {
+            if(!graph->link_node({node_at(link.from_node), link.from_slot}, {node_at(link.to_node), link.to_slot}))
+                throw std::runtime_error("Graph file links a slot that does not exist.");
+        }
+
+        return graph;
+    }
+
+    template<OptionalVariantLike Payload>
+    std::unique_ptr<ComputationGraph<Payload>> instantiate(GraphDescription const & description, NodeRegistry<Payload> const & registry) {
+        auto bytes = serialize(description);
+        return instantiate(GraphView(bytes), registry);
+    }
+
+    inline void save(GraphDescription const & graph, std::string const & path) {
+        auto bytes = serialize(graph);
+
+        std::ofstream file(path, std::ios::binary | std::ios::out | std::ios::trunc);
+        file.write(reinterpret_cast<char const *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+
+        if(!file)
+            throw std::runtime_error("Could not write graph file " + path);
+    }
+
+    // A graph file mapped read only into memory, or read into a buffer where mapping is not available.
+    class MappedGraphFile {
+        std::byte const * mapping = nullptr;
+        size_t length = 0;
+        std::vector<std::byte> fallback;
+
+        public:
+        explicit MappedGraphFile(std::string const & path) {
+#if defined(__unix__) || defined(__APPLE__)
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0)
+                throw std::runtime_error("Could not open graph file " + path);
+
+            struct stat info{};
+            if(::fstat(fd, &info) == 0 && info.st_size > 0) {
+                void * p = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if(p != MAP_FAILED) {
+                    mapping = static_cast<std::byte const *>(p);
+                    length = static_cast<size_t>(info.st_size);
+                }
+            }
+            ::close(fd);
+
+            if(mapping != nullptr)
+                return;
+#endif
+            std::ifstream file(path, std::ios::binary | std::ios::in | std::ios::ate);
+            if(!file)
+                throw std::runtime_error("Could not open graph file " + path);
+
+            fallback.resize(static_cast<size_t>(file.tellg()));
+            file.seekg(0);
+            file.read(reinterpret_cast<char *>(fallback.data()), static_cast<std::streamsize>(fallback.size()));
+        }
+
+        MappedGraphFile(MappedGraphFile const &) = delete;
+        MappedGraphFile &operator=(MappedGraphFile const &) = delete;
+
+        ~MappedGraphFile() {
+#if defined(__unix__) || defined(__APPLE__)
+            if(mapping != nullptr)
+                ::munmap(const_cast<std::byte *>(mapping), length);
+#endif
+        }
+
+        std::span<std::byte const> bytes() const noexcept {
+            if(mapping != nullptr)
+                return {mapping, length};
+            return fallback;
+        }
+
+        GraphView view() const {
+            return GraphView(bytes());
+        }
+    };
+
+    template<OptionalVariantLike Payload>
+    std::unique_ptr<ComputationGraph<Payload>> load(std::string const & path, NodeRegistry<Payload> const & registry) {
+        MappedGraphFile file(path);
+        return instantiate(file.view(), registry);
+    }
+
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <complex>
+#include <concepts>
+#include <cstdint>
 #include <numbers>
 #include <optional>
 #include <variant>
@@ -120,12 +122,16 @@ namespace LazyDAW {
         }
     };
 
-    struct FourierCoefficients {
-        using complex = std::complex<double>;
-        using iterator = std::vector<complex>::iterator;
-        using const_iterator = std::vector<complex>::const_iterator;
+    // Spectral buffers come in single and double precision. Each node picks the one it wants, float is
+    // plenty for 16 bit audio and halves the memory traffic.
+    template<std::floating_point Real>
+    struct BasicFourierCoefficients {
+        using real = Real;
+        using complex = std::complex<Real>;
+        using iterator = typename std::vector<complex>::iterator;
+        using const_iterator = typename std::vector<complex>::const_iterator;
 
-        std::vector<std::complex<double>> discrete_frequency_components;
+        std::vector<complex> discrete_frequency_components;
 
         iterator begin() noexcept {
             return discrete_frequency_components.begin();
@@ -175,9 +181,13 @@ namespace LazyDAW {
         }
     };
 
-    FourierCoefficients NaiveDiscreteFourierTransform(AudioSample const & amplitudes) {
-        using namespace std::complex_literals;
-        FourierCoefficients f;
+    using FourierCoefficients = BasicFourierCoefficients<double>;
+    using FourierCoefficientsF = BasicFourierCoefficients<float>;
+
+    template<std::floating_point Real = double>
+    BasicFourierCoefficients<Real> NaiveDiscreteFourierTransform(AudioSample const & amplitudes) {
+        using complex = std::complex<Real>;
+        BasicFourierCoefficients<Real> f;
         size_t sequence_length = amplitudes.size();
 
         f.zero_out(sequence_length);
@@ -187,19 +197,20 @@ namespace LazyDAW {
         for(auto i = 0; i < sequence_length; ++i) {
 
             for(auto j = 0; j < sequence_length; ++j) {
-                f[i] += static_cast<double>(amplitudes[j]) * std::exp(2.*std::numbers::pi_v<double>*static_cast<double>(i)*(0.-1.i)*static_cast<double>(j)/static_cast<double>(sequence_length));
+                f[i] += static_cast<Real>(amplitudes[j]) * std::exp(Real(2)*std::numbers::pi_v<Real>*static_cast<Real>(i)*complex(0, -1)*static_cast<Real>(j)/static_cast<Real>(sequence_length));
             }
         }
 
         return f;
     }
 
-     AudioSample NaiveDiscreteInverseFourierTransform(FourierCoefficients const & frequencies) {
-        using namespace std::complex_literals;
+    template<std::floating_point Real>
+     AudioSample NaiveDiscreteInverseFourierTransform(BasicFourierCoefficients<Real> const & frequencies) {
+        using complex = std::complex<Real>;
         // First will compute the inverse fourier transform as complex numbers
         // Then cast the real part to an int16_t.
         
-        FourierCoefficients f;
+        BasicFourierCoefficients<Real> f;
         size_t sequence_length = frequencies.size();
 
         f.zero_out(sequence_length);
@@ -209,7 +220,7 @@ namespace LazyDAW {
 
         for(auto i = 0; i < sequence_length; ++i) {
             for(auto j = 0; j < sequence_length; ++j) {
-                f[i] += 1./static_cast<double>(sequence_length) * static_cast<double>(frequencies[j].real()) * std::exp(2.*std::numbers::pi_v<double>*static_cast<double>(i)*(0.-1.i)*static_cast<double>(j)/static_cast<double>(sequence_length));
+                f[i] += Real(1)/static_cast<Real>(sequence_length) * static_cast<Real>(frequencies[j].real()) * std::exp(Real(2)*std::numbers::pi_v<Real>*static_cast<Real>(i)*complex(0, -1)*static_cast<Real>(j)/static_cast<Real>(sequence_length));
             }
 
         }
@@ -228,7 +239,7 @@ namespace LazyDAW {
 
 
     struct AudioRepresentation {
-        std::optional<std::variant<AudioSample,FourierCoefficients>> data;
+        std::optional<std::variant<AudioSample,FourierCoefficients,FourierCoefficientsF>> data;
 
         template<class T>
         AudioRepresentation(T t)
@@ -256,6 +267,11 @@ namespace LazyDAW {
             return nullptr;
         }
 
+        template <class T>
+        T & emplace() {
+            return std::get<T>(data.emplace(std::in_place_type<T>));
+        }
+
     };
 
 
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "computationgraph.hpp"
+
+
+namespace LazyDAW {
+
+    // Wraps a ComputationGraph so it can be edited (e.g. from the GUI) while the audio thread keeps
+    // calling compute(). Edits never touch the graph being processed: they are applied to a copy of its
+    // topology, which is then published through an atomic pointer, RCU style. The audio thread picks the
+    // new graph up at the start of its next compute(), moving the node state (the values sitting in the
+    // output slots) over from the old graph. Graphs the audio thread has moved past are destroyed by
+    // collect() on the editing side, so the audio thread never frees anything.
+    //
+    // There is meant to be exactly one audio thread calling compute(). Any number of threads may call
+    // edit(), replace() and collect(), they are serialized against each other.
+    template<OptionalVariantLike Payload>
+    class LiveComputationGraph {
+        using graph_t = ComputationGraph<Payload>;
+
+        // Output slot of the new graph, output slot of the graph it was cloned from, and the port type
+        // both had when the handoff was recorded.
+        struct handoff_slot {
+            Payload * to;
+            Payload * from;
+            port_type<Payload> type;
+        };
+        using handoff_t = std::vector<handoff_slot>;
+
+        // Where an output slot lives, used to spot slots the editor has reshaped.
+        struct slot_origin {
+            VertexWithEdgeData<Payload> const * node;
+            size_t revision;
+            port_type<Payload> type;
+
+            bool operator==(slot_origin const & other) const noexcept {
+                return node == other.node && revision == other.revision && type.same_as(other.type);
+            }
+        };
+        using slot_origins = std::unordered_map<Payload const *, slot_origin>;
+
+        struct published_graph {
+            std::unique_ptr<graph_t> graph;
+            handoff_t handoff;
+        };
+
+        // Owned by the audio thread.
+        published_graph * active;
+
+        // Set by the editing side, taken by the audio thread.
+        std::atomic<published_graph *> pending;
+
+        // The last graph the audio thread took. Everything published before it is garbage.
+        std::atomic<published_graph *> adopted;
+
+        std::mutex edit_mutex;
+
+        // In publication order. The adopted graph is in here, possibly followed by a pending one.
+        std::vector<std::unique_ptr<published_graph>> published;
+
+        public:
+        using computation_result = typename graph_t::computation_result;
+
+        LiveComputationGraph() : LiveComputationGraph(std::make_unique<graph_t>()) { }
+
+        explicit LiveComputationGraph(std::unique_ptr<graph_t> initial)
+            : active(nullptr),
+            pending(nullptr),
+            adopted(nullptr) {
+            published.push_back(std::make_unique<published_graph>(std::move(initial), handoff_t()));
+            active = published.back().get();
+            adopted.store(active);
+        }
+
+        LiveComputationGraph(LiveComputationGraph const &) = delete;
+        LiveComputationGraph &operator=(LiveComputationGraph const &) = delete;
+
+        // Audio thread only. Never locks, never allocates on its own account.
+        computation_result compute(Payload const & input) noexcept {
+            if(auto * next = pending.exchange(nullptr); next != nullptr) {
+                // A typed slot must keep holding its type, the pointers handed out by link_node
+                // depend on it. The old value may have changed alternative since the edit was made.
+                for(auto const & h : next->handoff)
+                    if(!h.type.is_typed() || h.type.holds(*h.from))
+                        std::swap(*h.to, *h.from);
+
+                active = next;
+                adopted.store(next);
+            }
+
+            return active->graph->compute(input);
+        }
+
+        // Copies the topology of the most recently published graph, lets editor mutate the copy (add
+        // nodes, relink, call set, ...), then publishes it. Output values are not read here since the
+        // audio thread may be writing them; they are swapped across when the audio thread adopts the
+        // graph, so downstream nodes keep seeing the previous block and the swap is not audible.
+        // Node functions holding state by pointer (delay lines) keep sharing it with the old graph, which
+        // is safe because the old graph stops being computed the moment the new one is adopted.
+        // If the graph was compensated (see ComputationGraph::compensate_latency) and the edit undid
+        // that, it is compensated again before publishing. editor may throw, in which case nothing is
+        // published.
+        template<class Editor>
+        void edit(Editor && editor) {
+            std::lock_guard lock(edit_mutex);
+
+            handoff_t handoff;
+
+            bool was_compensated = published.back()->graph->is_compensated();
+
+            auto next = published.back()->graph->clone([&handoff](Payload & copy, Payload const & original) {
+                handoff.push_back({&copy, const_cast<Payload *>(&original), {}});
+            });
+
+            auto before = origins(*next);
+            for(auto & h : handoff)
+                h.type = before.at(h.to).type;
+
+            std::forward<Editor>(editor)(*next);
+
+            // The audio thread must not be handed a graph that silently lost its delay compensation.
+            // If this throws nothing is published.
+            if(was_compensated && !next->is_compensated())
+                next->compensate_latency();
+
+            // The editor may have reshaped nodes. A node that was set again usually gets its output
+            // slots back at the same addresses, so only hand off into slots of nodes that were left
+            // alone and still carry the type they were cloned with.
+            auto after = origins(*next);
+            std::erase_if(handoff, [&before, &after](auto const & h) {
+                auto it = after.find(h.to);
+                return it == after.end() || !(it->second == before.at(h.to));
+            });
+
+            publish_locked(std::make_unique<published_graph>(std::move(next), std::move(handoff)));
+        }
+
+        // Publishes an entirely new graph, e.g. one built from scratch. No state is carried over.
+        void replace(std::unique_ptr<graph_t> next) {
+            std::lock_guard lock(edit_mutex);
+
+            publish_locked(std::make_unique<published_graph>(std::move(next), handoff_t()));
+        }
+
+        // Destroys every graph the audio thread has moved past. Returns the number still alive.
+        size_t collect() {
+            std::lock_guard lock(edit_mutex);
+
+            auto current = std::find_if(published.begin(), published.end(),
+                [seen = adopted.load()](auto const & p) { return p.get() == seen; });
+            published.erase(published.begin(), current);
+
+            return published.size();
+        }
+
+        private:
+        static slot_origins origins(graph_t & graph) {
+            slot_origins result;
+
+            auto add = [&result](VertexWithEdgeData<Payload> const & node) {
+                for(auto const & slot : node.output_slots)
+                    result.emplace(&slot.value, slot_origin{&node, node.revision, slot.type});
+            };
+
+            add(graph.peek_source());
+            add(graph.peek_sink());
+            for(auto const & node : graph.peek_interior())
+                add(node);
+
+            return result;
+        }
+
+        void publish_locked(std::unique_ptr<published_graph> next) {
+            // Take back whatever the audio thread has not picked up yet, so next can be fixed up before
+            // it becomes visible.
+            auto * unseen = pending.exchange(nullptr);
+
+            if(unseen != nullptr) {
+                // The audio thread never saw the previous edit, so the state still lives in the graph
+                // that one was cloned from. Chain the handoffs so they point straight at it.
+                std::unordered_map<Payload *, Payload *> earlier;
+                for(auto const & h : unseen->handoff)
+                    earlier.emplace(h.to, h.from);
+
+                std::erase_if(next->handoff, [&earlier](auto & h) {
+                    auto it = earlier.find(h.from);
+                    if(it == earlier.end())
+                        return true;
+                    h.from = it->second;
+                    return false;
+                });
+
+                std::erase_if(published, [unseen](auto const & p) { return p.get() == unseen; });
+            }
+
+            pending.store(next.get());
+            published.push_back(std::move(next));
+        }
+    };
+
+}
@@ -1,5 +1,7 @@
 #include "lazydaw.hpp"
 #include "computationgraph.hpp"
+#include "fourierplan.hpp"
+#include "standardnodes.hpp"
 
 #include <cassert>
 #include <cstring>
@@ -14,28 +16,29 @@ int main() {
     using namespace std::string_literals;
 
     ComputationGraph<AudioRepresentation> g;
+
+    g.set_source_type(audio_port<AudioSample>());
+    g.set_sink_type(audio_port<AudioSample>());
     
     g.add_interior_node();
     g.add_interior_node();
     g.add_interior_node();
 
-    g.peek_inner(0).set(1,1, [](auto const &input, auto &output) -> std::vector<error> {
-        auto const & optional_input = *input[0].maybe_value;
+    g.peek_inner(0).set({audio_port<AudioSample>()}, {audio_port<FourierCoefficientsF>()}, [](auto const &input, auto &output) -> std::vector<error> {
+        auto const & samples = input[0].template as<AudioSample>();
+        FourierPlan<float> plan(next_power_of_two(samples.size()));
 
-        if(optional_input.has_value())
-            output[0].value = AudioRepresentation(std::move(NaiveDiscreteFourierTransform(*optional_input.template get<AudioSample>())));
+        output[0].template as<FourierCoefficientsF>() = plan.forward(samples);
         return {};
     });
-    g.peek_inner(1).set(1,1, [](auto const &input, auto &output) -> std::vector<error> {
+    g.peek_inner(1).set({audio_port<FourierCoefficientsF>()}, {audio_port<FourierCoefficientsF>()}, [](auto const &input, auto &output) -> std::vector<error> {
         constexpr auto cutoff_freq = 10000.;
 
         size_t i = 0;
 
-        auto const * input_samples = input[0].maybe_value->template get<FourierCoefficients>();
-
-        output[0].value = FourierCoefficients();
+        auto const * input_samples = &input[0].template as<FourierCoefficientsF>();
 
-        auto  * output_samples = output[0].value.template get<FourierCoefficients>();
+        auto  * output_samples = &output[0].template as<FourierCoefficientsF>();
 
         output_samples->zero_out(input_samples->size());
 
@@ -51,20 +54,24 @@ int main() {
         
         return {};
     });
-    g.peek_inner(2).set(1,1,[](auto const &input, auto & output) -> std::vector<error> {
-        auto const & optional_payload = *input[0].maybe_value;
+    g.peek_inner(2).set({audio_port<FourierCoefficientsF>()}, {audio_port<AudioSample>()}, [](auto const &input, auto & output) -> std::vector<error> {
+        auto const & frequencies = input[0].template as<FourierCoefficientsF>();
+        FourierPlan<float> plan(frequencies.size());
 
-        if(optional_payload.has_value())
-            output[0].value = AudioRepresentation(std::move(NaiveDiscreteInverseFourierTransform(*optional_payload.template get<FourierCoefficients>())));
-        else
-            throw std::runtime_error("No value");
+        output[0].template as<AudioSample>() = plan.inverse_to_samples(frequencies);
         return {};
     });
 
-    g.link_node({&(g.peek_source()), 0}, {&g.peek_inner(0), 0});
-    g.link_node({&g.peek_inner(0), 0},{&g.peek_inner(1), 0});
-    g.link_node({&g.peek_inner(1), 0},{&g.peek_inner(2), 0});
-    g.link_node({&g.peek_inner(2), 0}, {&(g.peek_sink()), 0});
+    // Port types are checked here, e.g. feeding the samples straight into the filter is refused.
+    bool linked = g.link_node({&(g.peek_source()), 0}, {&g.peek_inner(0), 0})
+        && g.link_node({&g.peek_inner(0), 0},{&g.peek_inner(1), 0})
+        && g.link_node({&g.peek_inner(1), 0},{&g.peek_inner(2), 0})
+        && g.link_node({&g.peek_inner(2), 0}, {&(g.peek_sink()), 0});
+
+    if(!linked) {
+        std::cout << "Could not link the graph, mismatched port types.\n";
+        return EXIT_FAILURE;
+    }
 
     std::ifstream input("input.wav", std::ios::binary | std::ios::in);
 
@@ -89,7 +96,8 @@ int main() {
     AudioRepresentation p;
     AudioSample wav;
 
-    wav.zero_out(*truncated_size-44);
+    size_t const wav_length = *truncated_size-44;
+    wav.zero_out(wav_length);
 
     std::memcpy(&*wav.begin(),
                 &raw_input[44],
@@ -113,6 +121,9 @@ int main() {
 
     auto & real_output = raw_output.result.template get<AudioSample>()->discrete_amplitudes;
 
+    // The transforms pad to a power of two, drop the tail again.
+    real_output.resize(std::min(real_output.size(), wav_length));
+
     std::ofstream output("output.wav", std::ios::binary | std::ios::out);
 
     output.write(reinterpret_cast<char const *>(&raw_input[0]),44);
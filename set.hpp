@@ -49,23 +49,17 @@ namespace jl {
             }
 
             iterator find(T const &t) noexcept {
-                return std::lower_bound(dynamic_array.begin(), dynamic_array.end(), t);
-            }
-
-            iterator find(T &&t) noexcept {
-                return std::lower_bound(dynamic_array.begin(), dynamic_array.end(), t);
+                auto it = std::lower_bound(dynamic_array.begin(), dynamic_array.end(), t);
+                return (it != dynamic_array.end() && !(t < *it)) ? it : dynamic_array.end();
             }
 
             const_iterator find(T const &t) const noexcept {
-                return std::lower_bound(dynamic_array.begin(), dynamic_array.end(), t);
-            }
-
-            const_iterator find(T &&t) const noexcept {
-                return std::lower_bound(dynamic_array.begin(), dynamic_array.end(), t);
+                auto it = std::lower_bound(dynamic_array.begin(), dynamic_array.end(), t);
+                return (it != dynamic_array.end() && !(t < *it)) ? it : dynamic_array.end();
             }
 
             bool contains(T const &t) const noexcept {
-                return dynamic_array.end() == std::lower_bound(dynamic_array.begin(), dynamic_array.end(), t);
+                return find(t) != dynamic_array.end();
             }
 
             void reserve(size_t capacity) {
@@ -97,8 +91,8 @@ namespace jl {
             }
 
             void insert(T t) {
-                auto it = find(t);
-                if( (it == dynamic_array.end()) || (*it < t)) {
+                auto it = std::lower_bound(dynamic_array.begin(), dynamic_array.end(), t);
+                if( (it == dynamic_array.end()) || (t < *it)) {
                     dynamic_array.insert(it, t);
                 }
             }
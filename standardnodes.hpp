@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "lazydaw.hpp"
+#include "computationgraph.hpp"
+#include "fourierplan.hpp"
+#include "graphformat.hpp"
+
+
+namespace LazyDAW {
+
+    // The node types that can be saved in a graph file, along with helpers that describe them. The
+    // spectral nodes all work in single precision.
+    //
+    //  passthrough         1 in, 1 out.
+    //  gain                AudioSample -> AudioSample, parameters {factor}.
+    //  fft                 AudioSample -> FourierCoefficientsF, parameters {length}, table: plan twiddles.
+    //  ifft                FourierCoefficientsF -> AudioSample, parameters {length}, table: plan twiddles.
+    //  spectral_highpass   FourierCoefficientsF -> FourierCoefficientsF, parameters {first kept bin}.
+    //  convolve            FourierCoefficientsF -> FourierCoefficientsF, table: impulse response spectrum.
+    //  delay               AudioSample -> AudioSample, parameters {samples}. Has a latency of samples.
+
+    using error_list = std::vector<error>;
+
+    namespace detail {
+        inline double parameter(NodeView const & node, size_t i) {
+            if(i >= node.parameters.size())
+                throw std::runtime_error("Node of type \"" + std::string(node.type) + "\" is missing a parameter.");
+            if(!std::isfinite(node.parameters[i]))
+                throw std::runtime_error("Node of type \"" + std::string(node.type) + "\" has a parameter that is not a finite number.");
+            return node.parameters[i];
+        }
+
+        // Lengths and counts read from a file size allocations, so they are checked before the cast.
+        inline constexpr size_t max_count_parameter = size_t(1) << 26;
+
+        inline size_t count_parameter(NodeView const & node, size_t i) {
+            auto value = parameter(node, i);
+
+            if(value < 0. || value != std::floor(value) || value > static_cast<double>(max_count_parameter))
+                throw std::runtime_error("Node of type \"" + std::string(node.type) + "\" has a parameter that is not a count in range.");
+            return static_cast<size_t>(value);
+        }
+
+        // History of a delay line. Copies of the node function share it, so a graph cloned by
+        // LiveComputationGraph carries on where the old one left off; see ComputationGraph::clone for
+        // why two clones must not be computed side by side.
+        struct delay_state {
+            std::vector<int16_t> history;
+            size_t position = 0;
+        };
+
+        inline std::shared_ptr<FourierPlan<float> const> plan_for(NodeView const & node) {
+            auto length = count_parameter(node, 0);
+            auto table = node.table_as<std::complex<float>>();
+
+            if(table.empty())
+                return std::make_shared<FourierPlan<float> const>(length);
+            return std::make_shared<FourierPlan<float> const>(length, table);
+        }
+    }
+
+    template<class T>
+    inline port_type<AudioRepresentation> audio_port() noexcept {
+        return port_of<T, AudioRepresentation>();
+    }
+
+    inline NodeDescription describe_passthrough() {
+        return {"passthrough", {}, {}};
+    }
+
+    inline NodeDescription describe_gain(double factor) {
+        return {"gain", {factor}, {}};
+    }
+
+    inline NodeDescription describe_fft(size_t length) {
+        auto table = FourierPlan<float>(length).table();
+        return {"fft", {static_cast<double>(length)}, to_table<std::complex<float>>(table)};
+    }
+
+    inline NodeDescription describe_ifft(size_t length) {
+        auto table = FourierPlan<float>(length).table();
+        return {"ifft", {static_cast<double>(length)}, to_table<std::complex<float>>(table)};
+    }
+
+    inline NodeDescription describe_spectral_highpass(size_t first_kept_bin) {
+        return {"spectral_highpass", {static_cast<double>(first_kept_bin)}, {}};
+    }
+
+    // Stores the spectrum of impulse_response zero padded to length, so loading does not redo the FFT.
+    inline NodeDescription describe_convolution(AudioSample const & impulse_response, size_t length) {
+        auto spectrum = FourierPlan<float>(length).forward(impulse_response);
+        return {"convolve", {}, to_table<std::complex<float>>(spectrum.discrete_frequency_components)};
+    }
+
+    inline NodeDescription describe_delay(size_t samples) {
+        return {"delay", {static_cast<double>(samples)}, {}};
+    }
+
+    // Turns node into a delay line of the given length. The history is allocated here, not on the
+    // audio thread.
+    inline void set_delay_line(VertexWithEdgeData<AudioRepresentation> & node, size_t samples) {
+        auto state = std::make_shared<detail::delay_state>();
+        state->history.assign(samples, 0);
+
+        node.set({audio_port<AudioSample>()}, {audio_port<AudioSample>()}, [state](auto const & inputs, auto & outputs) -> error_list {
+            auto const & samples = inputs[0].template as<AudioSample>();
+            auto & delayed = outputs[0].template as<AudioSample>();
+            auto & history = state->history;
+
+            delayed.discrete_amplitudes.resize(samples.size());
+
+            if(history.empty()) {
+                std::copy(samples.begin(), samples.end(), delayed.begin());
+                return {};
+            }
+
+            for(size_t i = 0; i < samples.size(); ++i) {
+                delayed[i] = history[state->position];
+                history[state->position] = samples[i];
+                state->position = state->position + 1 == history.size() ? 0 : state->position + 1;
+            }
+
+            return {};
+        });
+        node.set_latency(samples);
+    }
+
+    // The make_delay argument of ComputationGraph::compensate_latency. Only sample streams can be
+    // delayed by a number of samples; for edges carrying anything else compensate_latency throws before
+    // changing the graph, so put the latent node on the sample side of its transforms instead.
+    inline void set_compensating_delay(VertexWithEdgeData<AudioRepresentation> & node, size_t samples, port_type<AudioRepresentation> const & type) {
+        if(type.is_typed() && !type.same_as(audio_port<AudioSample>()))
+            throw std::invalid_argument("set_compensating_delay() can only delay AudioSample ports.");
+
+        set_delay_line(node, samples);
+    }
+
+    inline NodeRegistry<AudioRepresentation> standard_node_registry() {
+        NodeRegistry<AudioRepresentation> registry;
+
+        registry.add("passthrough", [](auto & node, NodeView const &) {
+            node.set(1, 1, [](auto const & inputs, auto & outputs) -> error_list {
+                outputs[0].value = *inputs[0].maybe_value;
+                return {};
+            });
+        });
+
+        registry.add("gain", [](auto & node, NodeView const & description) {
+            auto factor = detail::parameter(description, 0);
+
+            node.set({audio_port<AudioSample>()}, {audio_port<AudioSample>()}, [factor](auto const & inputs, auto & outputs) -> error_list {
+                auto const & samples = inputs[0].template as<AudioSample>();
+                auto & scaled = outputs[0].template as<AudioSample>();
+
+                scaled.discrete_amplitudes.resize(samples.size());
+                for(size_t i = 0; i < samples.size(); ++i)
+                    scaled[i] = static_cast<int16_t>(std::clamp(samples[i] * factor, double(INT16_MIN), double(INT16_MAX)));
+
+                return {};
+            });
+        });
+
+        registry.add("fft", [](auto & node, NodeView const & description) {
+            node.set({audio_port<AudioSample>()}, {audio_port<FourierCoefficientsF>()}, [plan = detail::plan_for(description)](auto const & inputs, auto & outputs) -> error_list {
+                outputs[0].template as<FourierCoefficientsF>() = plan->forward(inputs[0].template as<AudioSample>());
+                return {};
+            });
+        });
+
+        registry.add("ifft", [](auto & node, NodeView const & description) {
+            node.set({audio_port<FourierCoefficientsF>()}, {audio_port<AudioSample>()}, [plan = detail::plan_for(description)](auto const & inputs, auto & outputs) -> error_list {
+                auto const & frequencies = inputs[0].template as<FourierCoefficientsF>();
+                if(frequencies.size() != plan->size())
+                    return {error("ifft expects FourierCoefficientsF of the plan's length.")};
+
+                outputs[0].template as<AudioSample>() = plan->inverse_to_samples(frequencies);
+                return {};
+            });
+        });
+
+        registry.add("spectral_highpass", [](auto & node, NodeView const & description) {
+            auto first_kept_bin = detail::count_parameter(description, 0);
+
+            node.set({audio_port<FourierCoefficientsF>()}, {audio_port<FourierCoefficientsF>()}, [first_kept_bin](auto const & inputs, auto & outputs) -> error_list {
+                auto const & frequencies = inputs[0].template as<FourierCoefficientsF>();
+                auto & filtered = outputs[0].template as<FourierCoefficientsF>();
+
+                filtered.discrete_frequency_components.assign(frequencies.begin(), frequencies.end());
+                std::fill_n(filtered.begin(), std::min(first_kept_bin, filtered.size()), std::complex<float>(0));
+
+                return {};
+            });
+        });
+
+        registry.add("convolve", [](auto & node, NodeView const & description) {
+            auto table = description.table_as<std::complex<float>>();
+            auto spectrum = std::make_shared<std::vector<std::complex<float>> const>(table.begin(), table.end());
+
+            node.set({audio_port<FourierCoefficientsF>()}, {audio_port<FourierCoefficientsF>()}, [spectrum](auto const & inputs, auto & outputs) -> error_list {
+                auto const & frequencies = inputs[0].template as<FourierCoefficientsF>();
+                if(frequencies.size() != spectrum->size())
+                    return {error("convolve expects FourierCoefficientsF of the impulse response's length.")};
+
+                auto & product = outputs[0].template as<FourierCoefficientsF>();
+                product.discrete_frequency_components.resize(frequencies.size());
+                for(size_t i = 0; i < product.size(); ++i)
+                    product[i] = frequencies[i] * (*spectrum)[i];
+
+                return {};
+            });
+        });
+
+        registry.add("delay", [](auto & node, NodeView const & description) {
+            set_delay_line(node, detail::count_parameter(description, 0));
+        });
+
+        return registry;
+    }
+
+}
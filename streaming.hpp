@@ -0,0 +1,500 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "lazydaw.hpp"
+#include "computationgraph.hpp"
+#include "standardnodes.hpp"
+
+
+namespace LazyDAW {
+
+    // Playing many long tracks straight from disk.
+    //
+    // Every track has a fixed size read ahead ring that a small pool of I/O threads keeps topped up,
+    // neediest track first, from the position the track is being played at. Reads go through a block
+    // cache shared by all tracks, bounded and least recently used first out, so memory stays flat no
+    // matter how many or how long the tracks are, and seeking back (loops, punch ins) is usually free.
+    //
+    // The processing thread only ever copies out of the ring. It never waits on a lock or on the disk;
+    // if the ring runs dry it plays silence, counts an underrun, and skips ahead once data arrives so the
+    // track stays in time with the others.
+
+    struct StreamingSettings {
+        size_t io_threads = 2;
+        size_t max_tracks = 256;
+
+        // Unit of disk reads and of the cache, in samples.
+        size_t block_samples = 16384;
+        size_t cache_blocks = 256;
+
+        // Per track read ahead, in samples. Rounded up to a power of two.
+        size_t ring_samples = size_t(1) << 17;
+
+        // Blocks beyond the end of the ring pulled into the cache ahead of time.
+        size_t prefetch_blocks = 4;
+    };
+
+    // Enough of a RIFF/WAVE header to stream 16 bit PCM. Channels stay interleaved.
+    struct WavInfo {
+        uint16_t channels = 0;
+        uint32_t sample_rate = 0;
+        uint64_t data_offset = 0;
+        uint64_t sample_count = 0;
+    };
+
+    inline WavInfo read_wav_header(std::istream & in) {
+        auto read_u32 = [&in]() { uint32_t v = 0; in.read(reinterpret_cast<char *>(&v), 4); return v; };
+        auto read_u16 = [&in]() { uint16_t v = 0; in.read(reinterpret_cast<char *>(&v), 2); return v; };
+
+        char id[4];
+        in.read(id, 4);
+        read_u32();
+        char wave[4];
+        in.read(wave, 4);
+
+        if(!in || std::memcmp(id, "RIFF", 4) != 0 || std::memcmp(wave, "WAVE", 4) != 0)
+            throw std::runtime_error("Not a RIFF/WAVE file.");
+
+        WavInfo info;
+        bool have_format = false;
+
+        while(in.read(id, 4)) {
+            uint32_t size = read_u32();
+            auto next = static_cast<std::streamoff>(in.tellg()) + size + (size & 1);
+
+            if(std::memcmp(id, "fmt ", 4) == 0) {
+                auto format = read_u16();
+                info.channels = read_u16();
+                info.sample_rate = read_u32();
+                read_u32();
+                read_u16();
+                auto bits = read_u16();
+
+                if(format != 1 || bits != 16)
+                    throw std::runtime_error("Only 16 bit PCM WAV files can be streamed.");
+                have_format = true;
+            }
+            else if(std::memcmp(id, "data", 4) == 0) {
+                if(!have_format)
+                    throw std::runtime_error("WAV data chunk comes before the format chunk.");
+
+                info.data_offset = static_cast<uint64_t>(in.tellg());
+                info.sample_count = size / sizeof(int16_t);
+
+                // Recordings that were cut short still claim their full length, believe the file size.
+                in.seekg(0, std::ios::end);
+                if(auto end = in.tellg(); end != std::streampos(-1))
+                    info.sample_count = std::min<uint64_t>(info.sample_count, (static_cast<uint64_t>(end) - std::min<uint64_t>(info.data_offset, end)) / sizeof(int16_t));
+                in.clear();
+                in.seekg(static_cast<std::streamoff>(info.data_offset));
+
+                return info;
+            }
+
+            in.seekg(next);
+        }
+
+        throw std::runtime_error("WAV file has no data chunk.");
+    }
+
+    // Single producer, single consumer ring of samples. Which thread is the producer may change, as long
+    // as the hand over is synchronized (StreamingTrack does it with its servicing flag).
+    class SampleRing {
+        std::vector<int16_t> buffer;
+        size_t mask;
+
+        alignas(64) std::atomic<size_t> read_index;
+        alignas(64) std::atomic<size_t> write_index;
+
+        public:
+        explicit SampleRing(size_t capacity)
+            : buffer(std::bit_ceil(std::max<size_t>(capacity, 2))),
+            mask(buffer.size() - 1),
+            read_index(0),
+            write_index(0) { }
+
+        size_t capacity() const noexcept { return buffer.size(); }
+
+        size_t readable() const noexcept {
+            return write_index.load(std::memory_order_acquire) - read_index.load(std::memory_order_acquire);
+        }
+
+        size_t writable() const noexcept {
+            return capacity() - readable();
+        }
+
+        // Producer side.
+        size_t push(int16_t const * samples, size_t count) noexcept {
+            auto w = write_index.load(std::memory_order_relaxed);
+            count = std::min(count, capacity() - (w - read_index.load(std::memory_order_acquire)));
+
+            for(size_t i = 0; i < count; ++i)
+                buffer[(w + i) & mask] = samples[i];
+
+            write_index.store(w + count, std::memory_order_release);
+            return count;
+        }
+
+        // Consumer side.
+        size_t pop(int16_t * samples, size_t count) noexcept {
+            auto r = read_index.load(std::memory_order_relaxed);
+            count = std::min(count, write_index.load(std::memory_order_acquire) - r);
+
+            for(size_t i = 0; i < count; ++i)
+                samples[i] = buffer[(r + i) & mask];
+
+            read_index.store(r + count, std::memory_order_release);
+            return count;
+        }
+
+        size_t discard(size_t count) noexcept {
+            auto r = read_index.load(std::memory_order_relaxed);
+            count = std::min(count, write_index.load(std::memory_order_acquire) - r);
+            read_index.store(r + count, std::memory_order_release);
+            return count;
+        }
+
+        // Only while the consumer has promised not to touch the ring.
+        void flush_from_producer() noexcept {
+            read_index.store(write_index.load(std::memory_order_relaxed), std::memory_order_release);
+        }
+    };
+
+    // Blocks of decoded samples keyed by (file, block). Shared between the I/O threads only.
+    class BlockCache {
+        public:
+        using block_t = std::shared_ptr<std::vector<int16_t> const>;
+
+        private:
+        using key_t = std::pair<uint32_t, uint64_t>;
+
+        struct key_hash {
+            size_t operator()(key_t const & k) const noexcept {
+                return std::hash<uint64_t>()(k.second * 0x9E3779B97F4A7C15ull ^ k.first);
+            }
+        };
+
+        size_t capacity;
+        std::mutex mutex;
+        std::list<std::pair<key_t, block_t>> recency;
+        std::unordered_map<key_t, decltype(recency)::iterator, key_hash> index;
+
+        public:
+        explicit BlockCache(size_t capacity) : capacity(std::max<size_t>(capacity, 1)) { }
+
+        block_t find(uint32_t file, uint64_t block) {
+            std::lock_guard lock(mutex);
+
+            auto it = index.find({file, block});
+            if(it == index.end())
+                return nullptr;
+
+            recency.splice(recency.begin(), recency, it->second);
+            return it->second->second;
+        }
+
+        void insert(uint32_t file, uint64_t block, block_t data) {
+            std::lock_guard lock(mutex);
+
+            if(auto it = index.find({file, block}); it != index.end()) {
+                recency.splice(recency.begin(), recency, it->second);
+                return;
+            }
+
+            recency.emplace_front(key_t{file, block}, std::move(data));
+            index.emplace(key_t{file, block}, recency.begin());
+
+            while(recency.size() > capacity) {
+                index.erase(recency.back().first);
+                recency.pop_back();
+            }
+        }
+
+        size_t size() {
+            std::lock_guard lock(mutex);
+            return recency.size();
+        }
+    };
+
+    class StreamingEngine;
+
+    class StreamingTrack {
+        friend class StreamingEngine;
+
+        StreamingEngine * engine;
+        uint32_t file_id;
+        std::string path;
+        WavInfo info;
+
+        // Producer (I/O) side. Only changed by the worker holding servicing, fetch_position is also
+        // looked at by the others to judge how needy the track is.
+        std::ifstream file;
+        std::atomic<uint64_t> fetch_position;
+        std::atomic_flag servicing;
+
+        SampleRing ring;
+
+        // Consumer (processing) side.
+        uint64_t skip = 0;
+        std::atomic<uint64_t> play_position;
+        std::atomic<uint64_t> underruns;
+
+        // Seeks are handed to the producer: the consumer writes seek_target, bumps seek_generation and
+        // plays silence until the producer has flushed the ring and echoed the generation back.
+        std::atomic<uint64_t> seek_target;
+        std::atomic<uint64_t> seek_generation;
+        std::atomic<uint64_t> seek_acknowledged;
+
+        StreamingTrack(StreamingEngine * engine, uint32_t file_id, std::string path, size_t ring_samples)
+            : engine(engine),
+            file_id(file_id),
+            path(std::move(path)),
+            file(this->path, std::ios::binary | std::ios::in),
+            fetch_position(0),
+            ring(ring_samples),
+            play_position(0),
+            underruns(0),
+            seek_target(0),
+            seek_generation(0),
+            seek_acknowledged(0) {
+            if(!file)
+                throw std::runtime_error("Could not open " + this->path + " for streaming.");
+            info = read_wav_header(file);
+        }
+
+        bool seek_pending() const noexcept {
+            return seek_acknowledged.load(std::memory_order_acquire) != seek_generation.load(std::memory_order_acquire);
+        }
+
+        public:
+        WavInfo const & peek_info() const noexcept { return info; }
+        std::string const & peek_path() const noexcept { return path; }
+
+        uint64_t position() const noexcept { return play_position.load(std::memory_order_relaxed); }
+        uint64_t underrun_count() const noexcept { return underruns.load(std::memory_order_relaxed); }
+        size_t buffered() const noexcept { return ring.readable(); }
+
+        // Processing thread. Always fills all of out, with silence where data is missing.
+        inline void read(int16_t * out, size_t frames) noexcept;
+
+        // Processing thread.
+        inline void seek(uint64_t sample) noexcept;
+    };
+
+    class StreamingEngine {
+        StreamingSettings settings;
+        BlockCache cache;
+
+        // Fixed capacity so the I/O threads can walk it while add_track appends.
+        std::unique_ptr<std::unique_ptr<StreamingTrack>[]> tracks;
+        std::atomic<size_t> track_count;
+        std::mutex add_mutex;
+        std::unordered_map<std::string, uint32_t> file_ids;
+
+        std::mutex wake_mutex;
+        std::condition_variable wake_up;
+        std::vector<std::jthread> workers;
+
+        BlockCache::block_t fetch_block(StreamingTrack & track, uint64_t block) {
+            if(auto cached = cache.find(track.file_id, block))
+                return cached;
+
+            auto first = block * settings.block_samples;
+            auto count = std::min<uint64_t>(settings.block_samples, track.info.sample_count - std::min(first, track.info.sample_count));
+
+            auto data = std::make_shared<std::vector<int16_t>>(count);
+            track.file.clear();
+            track.file.seekg(static_cast<std::streamoff>(track.info.data_offset + first * sizeof(int16_t)));
+            track.file.read(reinterpret_cast<char *>(data->data()), static_cast<std::streamsize>(count * sizeof(int16_t)));
+            data->resize(static_cast<size_t>(track.file.gcount()) / sizeof(int16_t));
+
+            cache.insert(track.file_id, block, data);
+            return data;
+        }
+
+        // Tops up one track's ring. The caller holds track.servicing.
+        void service(StreamingTrack & track) {
+            if(track.seek_pending()) {
+                auto generation = track.seek_generation.load(std::memory_order_acquire);
+                track.fetch_position.store(std::min(track.seek_target.load(std::memory_order_acquire), track.info.sample_count));
+                track.ring.flush_from_producer();
+                track.seek_acknowledged.store(generation, std::memory_order_release);
+            }
+
+            while(track.fetch_position < track.info.sample_count && track.ring.writable() > 0 && !track.seek_pending()) {
+                auto position = track.fetch_position.load();
+                auto block = position / settings.block_samples;
+                auto offset = static_cast<size_t>(position % settings.block_samples);
+
+                auto data = fetch_block(track, block);
+
+                // The file ended early (it shrank since the header was read, or a read failed). Treat
+                // the track as finished rather than coming back for the same block over and over.
+                if(offset >= data->size()) {
+                    track.fetch_position.store(track.info.sample_count);
+                    break;
+                }
+
+                track.fetch_position += track.ring.push(data->data() + offset, data->size() - offset);
+            }
+
+            auto next_block = track.fetch_position / settings.block_samples + 1;
+            auto last_block = (track.info.sample_count + settings.block_samples - 1) / settings.block_samples;
+
+            for(uint64_t b = next_block; b < std::min(next_block + settings.prefetch_blocks, last_block); ++b)
+                fetch_block(track, b);
+        }
+
+        // A track needs attention if it is seeking or its ring is less than half full.
+        static double urgency(StreamingTrack const & track) noexcept {
+            if(track.seek_pending())
+                return 2.;
+            if(track.fetch_position.load(std::memory_order_relaxed) >= track.info.sample_count)
+                return 0.;
+            return 1. - static_cast<double>(track.ring.readable()) / static_cast<double>(track.ring.capacity());
+        }
+
+        void work(std::stop_token stop) {
+            while(!stop.stop_requested()) {
+                StreamingTrack * neediest = nullptr;
+                double most_urgent = 0.5;
+
+                auto count = track_count.load(std::memory_order_acquire);
+                for(size_t i = 0; i < count; ++i) {
+                    auto & track = *tracks[i];
+                    if(auto u = urgency(track); u > most_urgent && !track.servicing.test(std::memory_order_relaxed)) {
+                        neediest = &track;
+                        most_urgent = u;
+                    }
+                }
+
+                if(neediest != nullptr && !neediest->servicing.test_and_set(std::memory_order_acquire)) {
+                    try {
+                        service(*neediest);
+                    }
+                    catch(...) {
+                        // A failed read leaves the ring short, which the consumer sees as an underrun.
+                    }
+                    neediest->servicing.clear(std::memory_order_release);
+                    continue;
+                }
+
+                std::unique_lock lock(wake_mutex);
+                wake_up.wait_for(lock, std::chrono::milliseconds(2));
+            }
+        }
+
+        public:
+        explicit StreamingEngine(StreamingSettings settings = {})
+            : settings(settings),
+            cache(settings.cache_blocks),
+            tracks(new std::unique_ptr<StreamingTrack>[settings.max_tracks]),
+            track_count(0) {
+            for(size_t i = 0; i < std::max<size_t>(settings.io_threads, 1); ++i)
+                workers.emplace_back([this](std::stop_token stop) { work(stop); });
+        }
+
+        StreamingEngine(StreamingEngine const &) = delete;
+        StreamingEngine &operator=(StreamingEngine const &) = delete;
+
+        ~StreamingEngine() {
+            for(auto & worker : workers)
+                worker.request_stop();
+            wake_up.notify_all();
+            workers.clear();
+        }
+
+        // Not real time safe, call it while setting the session up.
+        StreamingTrack & add_track(std::string const & path) {
+            std::lock_guard lock(add_mutex);
+
+            auto count = track_count.load();
+            if(count == settings.max_tracks)
+                throw std::runtime_error("StreamingEngine is full, raise StreamingSettings::max_tracks.");
+
+            auto [it, inserted] = file_ids.try_emplace(path, static_cast<uint32_t>(file_ids.size()));
+            tracks[count].reset(new StreamingTrack(this, it->second, path, settings.ring_samples));
+
+            track_count.store(count + 1, std::memory_order_release);
+            wake_up.notify_one();
+
+            return *tracks[count];
+        }
+
+        void wake() noexcept {
+            wake_up.notify_one();
+        }
+
+        size_t cached_blocks() { return cache.size(); }
+    };
+
+    inline void StreamingTrack::read(int16_t * out, size_t frames) noexcept {
+        auto position = play_position.load(std::memory_order_relaxed);
+        auto remaining = info.sample_count - std::min(position, info.sample_count);
+
+        // The ring is not ours to read until the seek is acknowledged. Time keeps going though: the
+        // samples played as silence are skipped once the producer has started at the seek target.
+        if(seek_pending()) {
+            std::fill_n(out, frames, int16_t(0));
+            skip += std::min<uint64_t>(frames, remaining);
+            play_position.store(position + frames, std::memory_order_relaxed);
+            return;
+        }
+
+        // Make up for samples that were due while the ring was empty.
+        skip -= ring.discard(skip);
+
+        size_t got = skip == 0 ? ring.pop(out, frames) : 0;
+        std::fill_n(out + got, frames - got, int16_t(0));
+
+        if(got < std::min<uint64_t>(frames, remaining)) {
+            skip += std::min<uint64_t>(frames, remaining) - got;
+            underruns.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        play_position.store(position + frames, std::memory_order_relaxed);
+
+        if(ring.readable() < ring.capacity() / 2)
+            engine->wake();
+    }
+
+    inline void StreamingTrack::seek(uint64_t sample) noexcept {
+        skip = 0;
+        play_position.store(sample, std::memory_order_relaxed);
+        seek_target.store(sample, std::memory_order_release);
+        seek_generation.fetch_add(1, std::memory_order_acq_rel);
+        engine->wake();
+    }
+
+    // Makes node a streaming source for track. The node takes the block being processed as its input,
+    // only for its length, and outputs that many samples of the track.
+    inline void set_streaming_source(VertexWithEdgeData<AudioRepresentation> & node, StreamingTrack & track) {
+        node.set({audio_port<AudioSample>()}, {audio_port<AudioSample>()}, [&track](auto const & inputs, auto & outputs) -> std::vector<error> {
+            auto frames = inputs[0].template as<AudioSample>().size();
+            auto & out = outputs[0].template as<AudioSample>();
+
+            out.discrete_amplitudes.resize(frames);
+            track.read(out.data(), frames);
+
+            return {};
+        });
+    }
+
+}